@@ -0,0 +1,67 @@
+#ifndef CELL_GRID_H
+#define CELL_GRID_H
+
+#include "types.h"
+#include <stdint.h>
+
+/**
+ * @brief Allocates a grid of cols x rows cells
+ * @param cols Output width in characters
+ * @param rows Output height in characters
+ * @param slots Cell rows kept in memory, clamped to [1, rows]
+ * @param readers Number of consumers that will release every row
+ * @param colors Keep an RGB color per cell, false in grayscale mode where
+ *        only the gradient index is kept
+ * @return The grid on success, NULL on failure
+ */
+CellGrid *cell_grid_new(int cols, int rows, int slots, int readers,
+                        bool colors);
+
+/**
+ * @brief Frees a grid created with cell_grid_new, NULL is ignored
+ */
+void cell_grid_free(CellGrid *grid);
+
+// storage of a row, only valid between the wait and the publish/release
+static inline uint8_t *cell_grid_indices(const CellGrid *grid, int row) {
+  return grid->indices + (size_t)(row % grid->slots) * grid->cols;
+}
+
+// NULL in grayscale mode
+static inline uint8_t *cell_grid_colors(const CellGrid *grid, int row) {
+  if (!grid->colors) {
+    return NULL;
+  }
+  return grid->colors + (size_t)(row % grid->slots) * grid->cols * 3;
+}
+
+/**
+ * @brief Producer side, blocks until the slot of `row` can be written
+ * @return 0 when the slot is free, -1 if the grid was aborted
+ */
+int cell_grid_wait_slot(CellGrid *grid, int row);
+
+/**
+ * @brief Producer side, makes a converted row visible to the readers
+ */
+void cell_grid_publish(CellGrid *grid, int row);
+
+/**
+ * @brief Reader side, blocks until `row` has been converted
+ * @return 0 when the row is ready, -1 if the grid was aborted
+ */
+int cell_grid_wait_row(CellGrid *grid, int row);
+
+/**
+ * @brief Reader side, hands the slot of `row` back to the converter, every
+ * reader must release its rows in order
+ * @param reader Index of the reader, from 0 to readers - 1
+ */
+void cell_grid_release(CellGrid *grid, int reader, int row);
+
+/**
+ * @brief Wakes every stage waiting on the grid and makes them give up
+ */
+void cell_grid_abort(CellGrid *grid);
+
+#endif // !CELL_GRID_H
@@ -0,0 +1,15 @@
+#ifndef FONT_REGISTRY_H
+#define FONT_REGISTRY_H
+
+#include "stb/stb_truetype.h"
+
+/**
+ * @brief Looks up a bundled font, the first call for a font reads it from
+ * gresources and initializes it, later calls return the same font
+ * @param font_name Font filename under /org/asciiparser/data/fonts/
+ * @return The font, valid until the process exits. NULL if the font doesn't
+ *         exist or can't be parsed
+ */
+const stbtt_fontinfo *font_registry_get(const char *font_name);
+
+#endif // !FONT_REGISTRY_H
@@ -0,0 +1,49 @@
+#ifndef GLYPH_ATLAS_H
+#define GLYPH_ATLAS_H
+
+#include "stb/stb_truetype.h"
+#include <stdint.h>
+
+// one rasterized glyph, its coverage is a w x h block of the atlas
+typedef struct {
+  int codepoint;
+  int x, y;       // top left corner in the atlas
+  int w, h;       // bitmap size, 0 for blank glyphs like the space
+  int xoff, yoff; // bitmap origin relative to the pen on the baseline
+  int advance;    // pen advance in pixels
+} AtlasGlyph;
+
+// coverage of a set of glyphs rasterized once for a font at a pixel height,
+// packed in a single 8 bit bitmap. The coverage of every pixel is repeated
+// once per channel of the output, so a row of a glyph lines up byte for byte
+// with the row of pixels it is blended on
+typedef struct {
+  const stbtt_fontinfo *font;
+  float pixel_height;
+  float scale; // stbtt scale for pixel_height
+  int width, height;
+  int channels;
+  uint8_t *pixels; // width * height * channels coverage, 0 to 255
+  int count;
+  AtlasGlyph *glyphs; // in the order of the codepoints they were built for
+} GlyphAtlas;
+
+/**
+ * @brief Rasterizes the given codepoints of a font and packs them in an
+ * atlas
+ * @param font Initialized font, it must outlive the atlas
+ * @param pixel_height Font size, as for stbtt_ScaleForPixelHeight
+ * @param codepoints Codepoints to rasterize, glyphs[i] is codepoints[i]
+ * @param count Number of codepoints
+ * @param channels Channels of the image the glyphs are drawn on, 1 or 3
+ * @return The atlas, NULL if it could not be allocated or packed
+ */
+GlyphAtlas *glyph_atlas_new(const stbtt_fontinfo *font, float pixel_height,
+                            const int *codepoints, int count, int channels);
+
+/**
+ * @brief Frees an atlas created with glyph_atlas_new, NULL is ignored
+ */
+void glyph_atlas_free(GlyphAtlas *atlas);
+
+#endif // !GLYPH_ATLAS_H
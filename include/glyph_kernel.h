@@ -0,0 +1,27 @@
+#ifndef GLYPH_KERNEL_H
+#define GLYPH_KERNEL_H
+
+#include <stdint.h>
+
+// number of chars in the conversion gradient
+#define GRADIENT_SIZE 16
+
+/**
+ * @brief Converts a row of pixels into gradient indices and packed colors
+ * @param pixels Input pixels, 1 (gray), 3 (RGB) or 4 (RGBA) bytes each
+ * @param channels Number of color channels, 1, 3 or 4
+ * @param count Number of pixels in the row
+ * @param indices Output gradient index per pixel (0 is the darkest)
+ * @param colors Output packed RGB per pixel, may be NULL or equal to pixels
+ *        when channels is 3 to skip the copy. Must be NULL for gray pixels
+ */
+void pixels_to_glyphs(const uint8_t *pixels, int channels, int count,
+                      uint8_t *indices, uint8_t *colors);
+
+/**
+ * @brief Name of the implementation picked for this CPU
+ * @return "avx2", "sse2" or "scalar"
+ */
+const char *glyph_kernel_name(void);
+
+#endif // !GLYPH_KERNEL_H
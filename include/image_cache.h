@@ -0,0 +1,33 @@
+#ifndef IMAGE_CACHE_H
+#define IMAGE_CACHE_H
+
+#include "types.h"
+#include <stddef.h>
+
+/**
+ * @brief Creates an empty cache of decoded images
+ * @param budget Bytes the cached images may use together, the image in use
+ *        is kept even when it is larger. 0 keeps nothing but that image
+ * @return The cache, NULL if it could not be allocated
+ */
+ImageCache *image_cache_new(size_t budget);
+
+/**
+ * @brief Returns the decoded image of a file, decoding it only if the cache
+ * has no entry for the same path, modification time and size. Takes the
+ * same arguments as image_load_start
+ * @return A new reference on the load, NULL if the file can't be read or
+ *         its format is not supported. stdin, pipes and other files that
+ *         can't be stat'ed as regular files are never cached
+ */
+ImageLoad *image_cache_open(ImageCache *cache, const char *filepath,
+                            size_t memory_budget, double max_scale_w,
+                            double max_scale_h, bool grayscale);
+
+/**
+ * @brief Drops every entry and frees the cache, NULL is ignored. Loads
+ * still referenced elsewhere stay alive until they are released
+ */
+void image_cache_free(ImageCache *cache);
+
+#endif // !IMAGE_CACHE_H
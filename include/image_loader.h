@@ -0,0 +1,53 @@
+#ifndef IMAGE_LOADER_H
+#define IMAGE_LOADER_H
+
+#include "types.h"
+#include <stddef.h>
+
+/**
+ * @brief Maps an image file once, parses its header and starts decoding it
+ * on a background thread
+ * @param filepath Input image path
+ * @param memory_budget Bytes the decoded image may use together with its
+ *        summed-area table, the table is replaced by the smaller image
+ *        pyramid past it. A mapped JPEG whose pixels alone don't fit is
+ *        streamed instead of decoded. 0 for no limit
+ * @param max_scale_w Widest output grid, in cells per input pixel. JPEGs
+ *        may be decoded scaled down as long as they keep that many pixels
+ * @param max_scale_h Tallest output grid, in cells per input pixel
+ * @param grayscale Decode to a single gray channel whatever the file has
+ * @return The load with width, height, channels and one reference set, NULL
+ *         if the file can't be read or its format is not supported
+ */
+ImageLoad *image_load_start(const char *filepath, size_t memory_budget,
+                            double max_scale_w, double max_scale_h,
+                            bool grayscale);
+
+/**
+ * @brief Blocks until the decode started by image_load_start is over
+ * @return 0 when the pixels are ready or the load is streamed, -1 if the
+ *         decode failed
+ */
+int image_load_wait(ImageLoad *load);
+
+/**
+ * @brief Takes one more reference on a load
+ * @return The same load
+ */
+ImageLoad *image_load_ref(ImageLoad *load);
+
+/**
+ * @brief Bytes kept by the decoded pixels, their summed-area table and their
+ * reduced levels, the size of the full resolution pixels while the decode
+ * is still running. 0 for a streamed load
+ */
+size_t image_load_size(ImageLoad *load);
+
+/**
+ * @brief Drops a reference, never blocks. The decode holds a reference of
+ * its own, so the last one is dropped either here or when the decode ends
+ * and everything is freed then. NULL is ignored
+ */
+void image_load_unref(ImageLoad *load);
+
+#endif // !IMAGE_LOADER_H
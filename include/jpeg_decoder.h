@@ -0,0 +1,53 @@
+#ifndef JPEG_DECODER_H
+#define JPEG_DECODER_H
+
+#include "types.h"
+#include <stdint.h>
+
+// a JPEG being decoded a few rows at a time
+typedef struct JpegReader JpegReader;
+
+/**
+ * @brief Parses a JPEG and starts decoding it scaled down like
+ * jpeg_decode_scaled, the rows are then read in order with jpeg_reader_read
+ * @param file Mapped input file, must outlive the reader
+ * @param width Decoded width, only set on success
+ * @param height Decoded height, only set on success
+ * @param channels 1 (gray) or 3 (RGB), only set on success
+ * @return The reader, NULL if jpeg_decode_scaled would fail on the file
+ */
+JpegReader *jpeg_reader_open(const MappedFile *file, int min_width,
+                             int min_height, bool grayscale, int *width,
+                             int *height, int *channels);
+
+/**
+ * @brief Decodes the next rows of the image
+ * @param rows Output, count rows of width * channels bytes each
+ * @return 0 on success, -1 if the data is broken or runs past the last row
+ */
+int jpeg_reader_read(JpegReader *reader, uint8_t *rows, int count);
+
+/**
+ * @brief Frees a reader, whether or not every row was read. NULL is ignored
+ */
+void jpeg_reader_close(JpegReader *reader);
+
+/**
+ * @brief Decodes a JPEG with libjpeg, scaled down by 1/2, 1/4 or 1/8 in the
+ * DCT domain as far as the result still covers min_width x min_height
+ * @param file Mapped input file
+ * @param min_width Smallest decoded width the caller can use
+ * @param min_height Smallest decoded height the caller can use
+ * @param grayscale Decode color images to a single gray channel
+ * @param width Decoded width, only set on success
+ * @param height Decoded height, only set on success
+ * @param channels 1 (gray) or 3 (RGB), only set on success
+ * @return The pixels, allocated with malloc. NULL if the file is not a JPEG
+ *         this backend handles, the build has no libjpeg or the decode
+ *         failed, the caller then falls back to stb_image
+ */
+uint8_t *jpeg_decode_scaled(const MappedFile *file, int min_width,
+                            int min_height, bool grayscale, int *width,
+                            int *height, int *channels);
+
+#endif // !JPEG_DECODER_H
@@ -6,22 +6,56 @@
 #include <stdlib.h>
 #include <types.h>
 
+// readers of the cell grid rows
+#define RENDER_READER 0
+#define TEXT_READER 1
+
 /**
- * @brief Converts an RGB image to ASCII art and saves to file
- * @param output_filename Output file path
+ * @brief Converts an RGB image into a grid of gradient indices and colors
  * @param rgb_image Input image data
+ * @param sat Summed-area table of rgb_image, NULL to average the pixels
+ * @param pyramid Reduced levels of rgb_image, used when there is no table,
+ *        may be NULL
  * @param width Image width in pixels
  * @param height Image height in pixels
- * @param w_step Width sampling step
- * @param h_step Height sampling step
  * @param channels Number of color channels
- * @param ascii_colors Buffer to store color data
+ * @param bg_color Background the transparent pixels are composited on
+ * @param grid Output cells, each cell averages a block of the image, rows
+ *        are published as soon as they are converted. A grid without
+ *        colors (grayscale mode) takes a 1 or 2 channel image
+ * @return 0 on success, -1 on failure
+ */
+int convert_to_grid(const uint8_t *rgb_image, const SummedAreaTable *sat,
+                    const ImagePyramid *pyramid, int width, int height,
+                    int channels, const RGB *bg_color, CellGrid *grid);
+
+/**
+ * @brief Same as convert_to_grid for a streamed load, the JPEG is decoded
+ * again a band of rows at a time and each band is sampled before the next
+ * one is decoded
+ * @param image Streamed load, its file stays mapped while it is referenced
+ * @param band_size Bytes of decoded rows to keep at once, the band always
+ *        holds at least the tallest cell row
+ * @param bg_color Background the transparent pixels are composited on
+ * @param grid Output cells, rows are published band by band
+ * @return 0 on success, -1 on failure
+ */
+int convert_stream_to_grid(const ImageLoad *image, size_t band_size,
+                           const RGB *bg_color, CellGrid *grid);
+
+/**
+ * @brief Saves a converted cell grid as ASCII art to file
+ * @param output_filename Output file path
+ * @param grid Converted cells
+ * @param reader Index of this consumer of the grid rows
+ * @param write_size Size in bytes of each write of the text file
+ * @param progress_bar Progress bar to update, may be NULL
+ * @param total_chars Number of chars used to compute the progress
  * @return 0 on success, -1 on failure
  */
-int parse2file(char *output_filename, uint8_t *rgb_image, int width, int height,
-               int w_step, int h_step, int channels,
-               unsigned char *ascii_colors, GtkProgressBar *progress_bar,
-               int total_chars, GtkWindow *dialog);
+int parse2file(char *output_filename, CellGrid *grid, int reader,
+               size_t write_size, GtkProgressBar *progress_bar,
+               int total_chars);
 
 void *start_on_background(void *arg);
 #endif // !LOGIC_H
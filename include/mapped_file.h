@@ -0,0 +1,20 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include "types.h"
+
+/**
+ * @brief Maps a whole file read only, the kernel is told it will be read
+ * front to back
+ * @param fd Descriptor of a regular file, it is left open, the mapping keeps
+ *        the file alive on its own
+ * @return The mapping, NULL if the file is empty or can't be mapped
+ */
+MappedFile *mapped_file_open_fd(int fd);
+
+/**
+ * @brief Unmaps a file mapped with mapped_file_open_fd. NULL is ignored
+ */
+void mapped_file_close(MappedFile *file);
+
+#endif // !MAPPED_FILE_H
@@ -0,0 +1,52 @@
+#ifndef PNG_WRITER_H
+#define PNG_WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <zlib.h>
+
+// streaming PNG encoder, rows are filtered and deflated as they are written
+// so the whole image never has to be in memory and there is no 2 GB limit
+typedef struct {
+  FILE *file;
+  z_stream zs;
+  int width, height, channels;
+  int rows_written;
+  size_t row_bytes;  // width * channels
+  uint8_t *prev_row; // unfiltered previous row, zeros before the first
+  uint8_t *filtered; // 5 candidate filtered rows, each 1 + row_bytes
+  uint8_t *idat;     // deflate output, flushed as one IDAT chunk
+  size_t idat_size;
+} PngWriter;
+
+/**
+ * @brief Creates a PNG file and writes its header
+ * @param filename Output PNG filename
+ * @param width Image width in pixels
+ * @param height Image height in pixels
+ * @param channels 1 (gray) or 3 (RGB)
+ * @return The writer on success, NULL on failure
+ */
+PngWriter *png_writer_open(const char *filename, int width, int height,
+                           int channels);
+
+/**
+ * @brief Appends rows to the image, top to bottom
+ * @param writer Writer from png_writer_open
+ * @param rows First pixel of the first row
+ * @param stride Bytes between the start of two rows
+ * @param count Number of rows
+ * @return 0 on success, 1 on failure
+ */
+int png_writer_write_rows(PngWriter *writer, const uint8_t *rows,
+                          size_t stride, int count);
+
+/**
+ * @brief Finishes the image and frees the writer, every row must have been
+ * written unless the file is being discarded
+ * @return 0 on success, 1 on failure
+ */
+int png_writer_close(PngWriter *writer);
+
+#endif // !PNG_WRITER_H
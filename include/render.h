@@ -4,40 +4,45 @@
 #include "stb/stb_truetype.h"
 #include <stdint.h>
 #include <types.h>
-/*
- * @brief Renders ASCII art to a PNG image
- * @param output_filename Base output filename
- * @param output_w Output width in chars
- * @param output_h Output height in chars
- * @param ascii_colors Color data for ASCII chars
- * @param bg_color Color data for background image
- * @param font_family Font filename for rendering
- * @return 0 on success, 1 on failure
- */
-int renderAsciiPNG(char *output_filename, int output_w, int output_h,
-                   unsigned char *ascii_colors, RGB *bg_color,
-                   char *font_family, LoadingModal *loading_modal,
-                   int total_chars);
 
-/*
- * @brief Load a stb_truetype font
- * @param font_filename Font filename
- * @param font_buffer unsigned char buffer
- * @param font stbtt_fontinfo font pointer
- * @return 0 on success, 1 on failure
+// default height of a rendered char in pixels, chars are half as wide
+#define DEFAULT_GLYPH_HEIGHT 32
+// smallest height a budget can shrink the chars to
+#define MIN_GLYPH_HEIGHT 2
+
+/**
+ * @brief Picks the glyph height of a render so the PNG fits a budget
+ * @param cols Cells per row of the grid
+ * @param rows Rows of the grid
+ * @param channels Channels of the PNG, 3 (RGB) or 1 (gray)
+ * @param char_h Requested glyph height in pixels, never grown
+ * @param max_pixels Most pixels the PNG may have, 0 for no limit
+ * @param max_bytes Most bytes of uncompressed pixels, the compressed size
+ *        isn't known before encoding so it is bounded by this. 0 for no
+ *        limit
+ * @return char_h if it fits, else the largest whole pixel height that does,
+ *         at least MIN_GLYPH_HEIGHT
  */
-int load_font(const char *font_resource_path, unsigned char **font_buffer,
-              stbtt_fontinfo *font);
+float fit_glyph_height(int cols, int rows, int channels, float char_h,
+                       int64_t max_pixels, size_t max_bytes);
 
 /*
- * @brief Extract all the text in a file
- * @param filename text filename
- * @param full_content pointer referencing the all the text from file
+ * @brief Renders ASCII art to a PNG image
+ * @param output_filename PNG output filename
+ * @param grid Converted cells, rows are drawn as soon as they are published
+ * @param reader Index of the renderer as a consumer of the grid rows
+ * @param bg_color Color data for background image
+ * @param font_family Font filename for rendering
+ * @param char_h Height of a cell in pixels, cells are half as wide
+ * @param band_size Bytes of output pixels to keep in memory, the image is
+ *        encoded in bands of that size. 0 keeps the whole image
  * @return 0 on success, 1 on failure
  */
-static int get_text_from_file(char *filename, char **full_content);
+int renderAsciiPNG(char *output_filename, CellGrid *grid, int reader,
+                   RGB *bg_color, char *font_family, float char_h,
+                   LoadingModal *loading_modal, int total_chars,
+                   size_t band_size);
 
-static char switch_to_render_char(const char c);
 void displayRenderMenu(RGB *bg_color_render, char *font_family);
 
 #endif // !RENDER_H
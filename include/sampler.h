@@ -0,0 +1,132 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "types.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// the summed-area table wraps around at 2^32, cells up to this many pixels
+// still give exact averages (255 * 2^24 < 2^32)
+#define SAT_MAX_CELL_AREA ((int64_t)1 << 24)
+
+/**
+ * @brief Splits `src_len` source pixels into `cells` contiguous spans
+ * @param src_len Number of source pixels along the axis
+ * @param cells Number of output cells along the axis
+ * @param bounds Output array of cells + 1 entries, cell i covers
+ *        [bounds[i], cell_span_end(bounds, i))
+ */
+void compute_cell_bounds(int src_len, int cells, int *bounds);
+
+// when there are more cells than pixels a cell still covers the pixel at its
+// start instead of being empty
+static inline int cell_span_end(const int *bounds, int i) {
+  return bounds[i + 1] > bounds[i] ? bounds[i + 1] : bounds[i] + 1;
+}
+
+/**
+ * @brief Size of the widest span computed by compute_cell_bounds
+ */
+int max_cell_span(const int *bounds, int cells);
+
+/**
+ * @brief Averages every source pixel of one row of cells
+ * @param image Input image data
+ * @param width Image width in pixels
+ * @param y0 First source row covered by the cell row
+ * @param y1 One past the last source row covered by the cell row
+ * @param x_bounds Column spans computed by compute_cell_bounds
+ * @param cols Number of cells in the row
+ * @param sums Scratch accumulator of cols * 4 entries, 64 bit so any cell
+ *        size is summed exactly
+ * @param bg Background the transparent pixels are composited on, RGB or
+ *        gray like the output
+ * @param row_colors Output averaged RGB or gray per cell (cols * 3 or cols
+ *        bytes)
+ */
+typedef void (*SampleRowFn)(const uint8_t *image, int width, int y0, int y1,
+                            const int *x_bounds, int cols, uint64_t *sums,
+                            const uint8_t *bg, uint8_t *row_colors);
+
+/**
+ * @brief Picks the cell row sampler specialized for a channel layout
+ * @param channels 1 (gray), 2 (gray + alpha), 3 (RGB) or 4 (RGBA)
+ * @param out_channels Bytes written per cell, 3 for RGB or 1 for the
+ *        grayscale mode, which only takes 1 or 2 channel images
+ * @return The sampler, NULL for any other channel count
+ */
+SampleRowFn get_cell_row_sampler(int channels, int out_channels);
+
+/**
+ * @brief Builds the summed-area table of an image
+ * @param rgb_image Input image data, 1 to 4 channels
+ * @param width Image width in pixels
+ * @param height Image height in pixels
+ * @param channels Number of color channels
+ * @param planes Color sums per entry, 3 for RGB or 1 for the grayscale mode,
+ *        which only takes 1 or 2 channel images. Images with alpha get one
+ *        more sum per entry
+ * @return The table on success, NULL if it could not be allocated or the
+ *         channel count is not supported
+ */
+SummedAreaTable *sat_build(const uint8_t *rgb_image, int width, int height,
+                           int channels, int planes);
+
+/**
+ * @brief Bytes used by the summed-area table of a width x height image
+ * @param entry Sums per entry, the color planes plus 1 with alpha
+ */
+size_t sat_size(int width, int height, int entry);
+
+/**
+ * @brief Frees a table created with sat_build, NULL is ignored
+ */
+void sat_free(SummedAreaTable *sat);
+
+/**
+ * @brief Builds the reduced levels of an image, each one half the size of
+ * the one before, down to a single pixel
+ * @param image Input image data, 1 to 4 channels
+ * @param width Image width in pixels
+ * @param height Image height in pixels
+ * @param channels Number of color channels, kept by every level
+ * @return The pyramid on success, NULL if it could not be allocated or the
+ *         channel count is not supported
+ */
+ImagePyramid *pyramid_build(const uint8_t *image, int width, int height,
+                            int channels);
+
+/**
+ * @brief Bytes used by the levels of a pyramid
+ */
+size_t pyramid_size(const ImagePyramid *pyramid);
+
+/**
+ * @brief Smallest level that still has a pixel for every cell of a
+ * cols x rows grid
+ * @param pyramid Levels of the image, may be NULL
+ * @return The level, NULL if only the image itself is large enough
+ */
+const PyramidLevel *pyramid_pick_level(const ImagePyramid *pyramid, int cols,
+                                       int rows);
+
+/**
+ * @brief Frees a pyramid created with pyramid_build, NULL is ignored
+ */
+void pyramid_free(ImagePyramid *pyramid);
+
+/**
+ * @brief Same as a SampleRowFn but with four table lookups per cell
+ * @param sat Summed-area table of the input image
+ * @param y0 First source row covered by the cell row
+ * @param y1 One past the last source row covered by the cell row
+ * @param x_bounds Column spans computed by compute_cell_bounds
+ * @param cols Number of cells in the row
+ * @param bg Background the transparent pixels are composited on
+ * @param row_colors Output averaged RGB per cell (cols * planes bytes)
+ */
+void sat_sample_cell_row(const SummedAreaTable *sat, int y0, int y1,
+                         const int *x_bounds, int cols, const uint8_t *bg,
+                         uint8_t *row_colors);
+
+#endif // !SAMPLER_H
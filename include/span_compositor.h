@@ -0,0 +1,38 @@
+#ifndef SPAN_COMPOSITOR_H
+#define SPAN_COMPOSITOR_H
+
+#include <stdint.h>
+
+// a color repeated over enough bytes that any span offset modulo
+// COMPOSITE_PATTERN_PERIOD can load a full vector from it
+#define COMPOSITE_PATTERN_PERIOD 48
+#define COMPOSITE_PATTERN_SIZE 96
+
+/**
+ * @brief Fills a pattern with a color for composite_span
+ * @param pattern Output, COMPOSITE_PATTERN_SIZE bytes
+ * @param color channels bytes
+ * @param channels 1 (gray) or 3 (RGB)
+ */
+void composite_pattern_init(uint8_t *pattern, const uint8_t *color,
+                            int channels);
+
+/**
+ * @brief Blends a color over a span of pixels by 8 bit coverage,
+ * dst = (dst * (255 - coverage) + color * coverage) / 255 rounded, so a
+ * coverage of 0 keeps dst and 255 writes the color
+ * @param dst Pixels to blend, starting on the first byte of a pixel
+ * @param coverage One byte per byte of dst, repeated for every channel
+ * @param pattern Color built by composite_pattern_init
+ * @param bytes Length of the span in bytes, pixels * channels
+ */
+void composite_span(uint8_t *dst, const uint8_t *coverage,
+                    const uint8_t *pattern, int bytes);
+
+/**
+ * @brief Name of the implementation picked for this CPU
+ * @return "avx2", "sse2" or "scalar"
+ */
+const char *composite_kernel_name(void);
+
+#endif // !SPAN_COMPOSITOR_H
@@ -0,0 +1,33 @@
+#ifndef STREAM_READER_H
+#define STREAM_READER_H
+
+#include "stb/stb_image.h"
+#include "types.h"
+
+// stb_image callbacks over a StreamReader, `user` is the reader
+extern const stbi_io_callbacks stream_reader_callbacks;
+
+/**
+ * @brief Wraps a descriptor that can't be mapped, like stdin or a pipe
+ * @param fd Descriptor to read from, the reader owns it from now on
+ * @return The reader, NULL if it could not be allocated
+ */
+StreamReader *stream_reader_new(int fd);
+
+/**
+ * @brief Reads the rest of the stream into the buffer
+ * @return 0 on success, -1 if a read failed
+ */
+int stream_reader_drain(StreamReader *reader);
+
+/**
+ * @brief Moves the read position back to the first byte of the stream
+ */
+void stream_reader_rewind(StreamReader *reader);
+
+/**
+ * @brief Closes the descriptor and frees the buffer, NULL is ignored
+ */
+void stream_reader_free(StreamReader *reader);
+
+#endif // !STREAM_READER_H
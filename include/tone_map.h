@@ -0,0 +1,27 @@
+#ifndef TONE_MAP_H
+#define TONE_MAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Reduces 16 bit samples to 8 bit, rounded to the nearest level
+ * instead of dropping the low byte
+ * @param src Input samples
+ * @param count Number of samples
+ * @param dst Output samples, may be the same buffer as src
+ */
+void samples16_to_8(const uint16_t *src, size_t count, uint8_t *dst);
+
+/**
+ * @brief Tone maps linear HDR pixels to 8 bit, the exposure is set from the
+ * log-average luminance of the image and the result is gamma encoded
+ * @param src Input pixels, linear light
+ * @param count Number of pixels
+ * @param channels 1 to 4, a second or fourth channel is alpha and is only
+ *        clamped
+ * @param dst Output pixels, may be the same buffer as src
+ */
+void hdr_to_8(const float *src, size_t count, int channels, uint8_t *dst);
+
+#endif // !TONE_MAP_H
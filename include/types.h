@@ -1,7 +1,11 @@
 #ifndef TYPES_H
 #define TYPES_H
 #include <gtk/gtk.h>
+#include <pthread.h>
 #include <regex.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <time.h>
 
 typedef struct {
   uint8_t r;
@@ -9,6 +13,114 @@ typedef struct {
   uint8_t b;
 } RGB;
 
+// integral image of the decoded input, entry (x, y) holds the sum of R, G and
+// B (or of the gray level in grayscale mode, premultiplied by the alpha if
+// there is one) over every pixel above and to the left of it, so the table has
+// one extra row and column of zeros. Sums wrap
+// around at 2^32 which is fine as long as a single cell covers less than 2^24
+// pixels
+typedef struct {
+  int width, height; // input image size w*h, in pixels
+  int planes;        // color sums per entry, 3 or 1 in grayscale mode
+  bool alpha;        // one more sum per entry with the alpha of the pixels
+  uint32_t *sums;    // (width + 1) * (height + 1) * (planes + alpha) sums
+} SummedAreaTable;
+
+// reduced copies of the decoded input, each level averages 2x2 pixels of the
+// one above it. A conversion samples the smallest level that still has a
+// pixel per cell, so its cost follows the grid instead of the input
+typedef struct {
+  int width, height;
+  uint8_t *pixels; // same channels as the decoded input
+} PyramidLevel;
+
+typedef struct {
+  int channels;
+  int count;            // levels below the decoded input
+  PyramidLevel *levels; // levels[0] is half the size of the input
+} ImagePyramid;
+
+// result of a conversion, shared between the text writer and the renderer.
+// Only `slots` cell rows are kept in memory, row r lives in slot r % slots
+// and the converter can't reuse a slot until every reader released its row
+typedef struct {
+  int cols, rows;   // output size w*h, in chars
+  int slots;        // cell rows kept in memory, rows for a full grid
+  uint8_t *indices; // slots * cols gradient indices, 0 is the darkest
+  uint8_t *colors;  // slots * cols * 3 RGB bytes, NULL in grayscale mode
+
+  int *slot_row;    // row published in each slot, -1 if none yet
+  int readers;      // number of consumers of the rows
+  int *released;    // rows released so far by each reader
+  bool aborted;     // set when a stage failed, every wait returns -1
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+} CellGrid;
+
+// a read only mapping of a whole file, owned by the load that opened it
+typedef struct {
+  const uint8_t *data;
+  size_t size;
+} MappedFile;
+
+// an input that can't be mapped (stdin, a pipe), read on demand into a
+// buffer that keeps every byte so the stream can be parsed twice
+typedef struct {
+  int fd;
+  uint8_t *data;
+  size_t size, capacity; // bytes read so far, bytes allocated
+  size_t pos;            // read position of the decoder
+  bool eof;
+} StreamReader;
+
+// an input image, the header is read right away and the pixels are decoded
+// on a background thread. Everything but the header fields is only valid
+// once `done` is set
+typedef struct {
+  int width, height; // input image size w*h, in pixels
+  int channels;      // channels of the decoded pixels, 1 in grayscale mode
+  bool grayscale;    // decode to 1 channel and sum gray levels in the table
+  MappedFile *file;  // mapped once, released once it is decoded unless the
+                     // load is streamed
+  StreamReader *stream; // used instead of file when it can't be mapped
+  bool read_whole_stream; // the stream is read to the end before decoding
+  size_t memory_budget; // skip the summed-area table past it, 0 for no limit
+  int min_w, min_h;     // smallest decoded size that covers any output grid
+
+  uint8_t *pixels;      // decoded image, NULL if the decode failed
+  bool streamed; // a JPEG too large for the memory budget, left undecoded,
+                 // every conversion reads its rows from file a band at a
+                 // time instead of pixels
+  int pixels_w, pixels_h; // decoded size, below width x height when the
+                          // decoder could scale the image down
+  SummedAreaTable *sat; // NULL if it didn't fit
+  ImagePyramid *pyramid; // only built when the table didn't fit
+  bool done;
+  int refs; // the session cache, a running conversion and the decode
+            // itself may share it
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+} ImageLoad;
+
+// one decoded file of the session cache, it is the same file as long as its
+// modification time and size don't change
+typedef struct ImageCacheEntry {
+  char *path;
+  struct timespec mtime;
+  off_t size;
+  bool grayscale; // decoded to gray levels, not reusable in color
+  ImageLoad *load;
+  struct ImageCacheEntry *prev, *next;
+} ImageCacheEntry;
+
+// decoded images of the files opened in the GUI, least recently used ones
+// are dropped once the cache is over its budget. Only used from the GTK main
+// thread
+typedef struct {
+  ImageCacheEntry *head, *tail; // most recently used first
+  size_t budget;                // bytes of decoded images to keep
+} ImageCache;
+
 typedef struct {
   GtkWindow *window;
   GtkProgressBar *progress_bar;
@@ -36,6 +148,9 @@ typedef struct {
 
   RGB *bg_color;
   bool manual_sizing_enabled;
+  bool write_text_output; // also save the .txt next to the PNG
+  bool grayscale;         // one byte per pixel and per cell, 1 channel PNG
+                          // (--grayscale)
 
   int out_h, out_w;         // output size w*h, in chars
   int max_out_h, max_out_w; // max output size w*h, in chars
@@ -45,9 +160,18 @@ typedef struct {
   int img_w, img_h; // input image size w*h, in pixels
   int img_bpp;      // number of channels in the image
   int total_chars;
+  size_t text_write_size; // bytes per write of the output text file
+  size_t memory_budget;   // bytes a conversion may keep in memory, 0 for no
+                          // limit (--memory-budget)
+  float glyph_height;     // rendered char height in pixels (--glyph-size)
+  int64_t max_render_pixels; // shrink the chars past it, 0 for no limit
+                             // (--max-pixels)
+  size_t max_render_bytes;   // same for the uncompressed PNG size
+                             // (--max-png-size)
 
-  unsigned char *ascii_colors;
-  uint8_t *rgb_image;
+  CellGrid *grid;
+  ImageLoad *image; // decoded in the background while the user picks options
+  ImageCache *image_cache; // decoded images of the files opened this session
 
   regex_t decimal_regex;
 } AppData;
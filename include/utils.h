@@ -7,4 +7,32 @@
 
 const char *get_filename_ext(const char *filename);
 
+// same weights stb_image uses when it decodes to 1 channel
+static inline uint8_t rgb_to_gray(uint8_t r, uint8_t g, uint8_t b) {
+  return (r * 77 + g * 150 + b * 29) >> 8;
+}
+
+/**
+ * @brief Computes a * b * c for an allocation size without wrapping around
+ * @param out Result, only set on success
+ * @return 0 on success, 1 if the product doesn't fit in a size_t
+ */
+int checked_size_mul3(size_t a, size_t b, size_t c, size_t *out);
+
+/**
+ * @brief Number of worker threads to use for a job
+ * @param max_jobs Number of independent pieces of work available
+ * @return Online cores capped to max_jobs, at least 1
+ */
+int get_worker_count(int max_jobs);
+
+/**
+ * @brief Runs routine(arg) on `workers` threads and waits for all of them,
+ * the calling thread is one of the workers
+ * @param workers Number of threads, as returned by get_worker_count
+ * @param routine Worker body, pulls its own work from arg
+ * @param arg Shared job state
+ */
+void run_on_workers(int workers, void *(*routine)(void *), void *arg);
+
 #endif // !UTILS_H
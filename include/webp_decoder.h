@@ -0,0 +1,35 @@
+#ifndef WEBP_DECODER_H
+#define WEBP_DECODER_H
+
+#include "types.h"
+#include <stdint.h>
+
+/**
+ * @brief Parses the header of a WebP image
+ * @param file Mapped input file
+ * @param width Image width, only set on success
+ * @param height Image height, only set on success
+ * @param channels 3 (RGB) or 4 (RGBA), only set on success
+ * @return 1 if the file is a WebP image, 0 otherwise or if the build has no
+ *         libwebp
+ */
+int webp_info(const MappedFile *file, int *width, int *height, int *channels);
+
+/**
+ * @brief Decodes a WebP image with libwebp, scaled down by 1/2, 1/4 or 1/8
+ * as far as the result still covers min_width x min_height
+ * @param file Mapped input file
+ * @param min_width Smallest decoded width the caller can use
+ * @param min_height Smallest decoded height the caller can use
+ * @param grayscale Convert the pixels to a single gray channel
+ * @param width Decoded width, only set on success
+ * @param height Decoded height, only set on success
+ * @param channels 1 (gray), 3 (RGB) or 4 (RGBA), only set on success
+ * @return The pixels, allocated with malloc. NULL if the file is not a WebP
+ *         image, the build has no libwebp or the decode failed
+ */
+uint8_t *webp_decode_scaled(const MappedFile *file, int min_width,
+                            int min_height, bool grayscale, int *width,
+                            int *height, int *channels);
+
+#endif // !WEBP_DECODER_H
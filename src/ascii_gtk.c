@@ -1,13 +1,14 @@
 #include "about_gtk.h"
+#include "cell_grid.h"
 #include "gdk/gdk.h"
 #include "glib-object.h"
 #include "glib.h"
 #include "gtk/gtk.h"
 #include "gtk/gtkdropdown.h"
+#include "image_loader.h"
 #include "logic.h"
 #include "render.h"
 #include "stb/stb_image.h"
-#include "stb/stb_image_write.h"
 #include "types.h"
 #include <ascii_gtk.h>
 #include <bits/pthreadtypes.h>
@@ -19,6 +20,9 @@
 #include <time.h>
 #include <unistd.h>
 
+// cell rows in flight between the conversion and the rendering
+static const int pipeline_rows = 64;
+
 void file_dialog_response(GObject *source_object, GAsyncResult *result,
                           gpointer user_data) {
   (void)user_data;
@@ -240,13 +244,25 @@ void init_image_loading(GtkButton *btn, GParamSpec *pspec, AppData *app_data) {
           app_data->img_w, app_data->img_h, /* %d x %d (Input Size) */
           app_data->out_w, app_data->out_h  /* %d x %d (Output Size) */
   );
-  app_data->output_text_filepath =
-      g_strdup_printf("%s.txt", app_data->input_filepath);
-  app_data->output_filepath =
-      g_strdup_printf("%s.txt.png", app_data->input_filepath);
+  // stdin has no name of its own, its outputs go to the working directory
+  const char *output_base = strcmp(app_data->input_filepath, "-")
+                                ? app_data->input_filepath
+                                : "stdin";
+  app_data->output_text_filepath = g_strdup_printf("%s.txt", output_base);
+  app_data->output_filepath = g_strdup_printf("%s.txt.png", output_base);
   app_data->total_chars = (app_data->out_h) * (app_data->out_w);
-  app_data->ascii_colors =
-      malloc((app_data->out_h + 5) * (app_data->out_w + 5) * 3);
+  // the renderer and the text writer each read every row of the grid
+  app_data->grid = cell_grid_new(app_data->out_w, app_data->out_h,
+                                 pipeline_rows,
+                                 app_data->write_text_output ? 2 : 1,
+                                 !app_data->grayscale);
+  if (!app_data->grid) {
+    gtk_window_close(app_data->loading_modal->window);
+    return;
+  }
+  // the conversion keeps the image alive even if another file is opened
+  // and this one is dropped from the cache before it is over
+  image_load_ref(app_data->image);
   // create a thread to speed up the processing
   pthread_t t_bg;
   pthread_create(&t_bg, NULL, start_on_background, (void *)app_data);
@@ -0,0 +1,114 @@
+#include <cell_grid.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <utils.h>
+
+CellGrid *cell_grid_new(int cols, int rows, int slots, int readers,
+                        bool colors) {
+  CellGrid *grid = calloc(1, sizeof(CellGrid));
+  if (!grid) {
+    return NULL;
+  }
+  if (slots > rows) {
+    slots = rows;
+  }
+  if (slots < 1) {
+    slots = 1;
+  }
+  grid->cols = cols;
+  grid->rows = rows;
+  grid->slots = slots;
+  grid->readers = readers;
+  size_t indices_size, colors_size;
+  if (checked_size_mul3(cols, slots, 1, &indices_size) ||
+      checked_size_mul3(cols, slots, 3, &colors_size)) {
+    printf("Error: Cell grid %dx%d is too large\n", cols, rows);
+    free(grid);
+    return NULL;
+  }
+  grid->indices = malloc(indices_size);
+  grid->colors = colors ? malloc(colors_size) : NULL;
+  grid->slot_row = malloc(slots * sizeof(int));
+  grid->released = calloc(readers > 0 ? readers : 1, sizeof(int));
+  if (!grid->indices || (colors && !grid->colors) || !grid->slot_row ||
+      !grid->released) {
+    printf("Error: Failed to allocate cell grid\n");
+    free(grid->indices);
+    free(grid->colors);
+    free(grid->slot_row);
+    free(grid->released);
+    free(grid);
+    return NULL;
+  }
+  for (int i = 0; i < slots; i++) {
+    grid->slot_row[i] = -1;
+  }
+  pthread_mutex_init(&grid->lock, NULL);
+  pthread_cond_init(&grid->changed, NULL);
+  return grid;
+}
+
+void cell_grid_free(CellGrid *grid) {
+  if (!grid) {
+    return;
+  }
+  pthread_mutex_destroy(&grid->lock);
+  pthread_cond_destroy(&grid->changed);
+  free(grid->indices);
+  free(grid->colors);
+  free(grid->slot_row);
+  free(grid->released);
+  free(grid);
+}
+
+// rows below this one have been released by every reader
+static int slowest_reader(const CellGrid *grid) {
+  int slowest = grid->rows;
+  for (int i = 0; i < grid->readers; i++) {
+    if (grid->released[i] < slowest) {
+      slowest = grid->released[i];
+    }
+  }
+  return slowest;
+}
+
+int cell_grid_wait_slot(CellGrid *grid, int row) {
+  pthread_mutex_lock(&grid->lock);
+  while (!grid->aborted && row - slowest_reader(grid) >= grid->slots) {
+    pthread_cond_wait(&grid->changed, &grid->lock);
+  }
+  int res = grid->aborted ? -1 : 0;
+  pthread_mutex_unlock(&grid->lock);
+  return res;
+}
+
+void cell_grid_publish(CellGrid *grid, int row) {
+  pthread_mutex_lock(&grid->lock);
+  grid->slot_row[row % grid->slots] = row;
+  pthread_cond_broadcast(&grid->changed);
+  pthread_mutex_unlock(&grid->lock);
+}
+
+int cell_grid_wait_row(CellGrid *grid, int row) {
+  pthread_mutex_lock(&grid->lock);
+  while (!grid->aborted && grid->slot_row[row % grid->slots] != row) {
+    pthread_cond_wait(&grid->changed, &grid->lock);
+  }
+  int res = grid->aborted ? -1 : 0;
+  pthread_mutex_unlock(&grid->lock);
+  return res;
+}
+
+void cell_grid_release(CellGrid *grid, int reader, int row) {
+  pthread_mutex_lock(&grid->lock);
+  grid->released[reader] = row + 1;
+  pthread_cond_broadcast(&grid->changed);
+  pthread_mutex_unlock(&grid->lock);
+}
+
+void cell_grid_abort(CellGrid *grid) {
+  pthread_mutex_lock(&grid->lock);
+  grid->aborted = true;
+  pthread_cond_broadcast(&grid->changed);
+  pthread_mutex_unlock(&grid->lock);
+}
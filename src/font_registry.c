@@ -0,0 +1,76 @@
+#include <font_registry.h>
+#include <gio/gio.h>
+#include <glib.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// one font for the whole process, stb_truetype reads the GBytes of the
+// resource in place so the font data is never copied. Fonts are never freed,
+// a detached render may still be drawing with one when the app quits
+typedef struct FontEntry {
+  char *name;
+  GBytes *data;
+  stbtt_fontinfo info;
+  struct FontEntry *next;
+} FontEntry;
+
+static FontEntry *fonts = NULL;
+// renders run on background threads, the GUI may start one while another
+// is still going
+static pthread_mutex_t fonts_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static FontEntry *load_font(const char *font_name) {
+  char *resource_path =
+      g_strdup_printf("/org/asciiparser/data/fonts/%s", font_name);
+  // compressed resources are inflated here, once per process
+  GBytes *data = g_resources_lookup_data(resource_path,
+                                         G_RESOURCE_LOOKUP_FLAGS_NONE, NULL);
+  if (!data) {
+    printf("Error: Failed to load font resource at path '%s'\n",
+           resource_path);
+    g_free(resource_path);
+    return NULL;
+  }
+  g_free(resource_path);
+
+  FontEntry *entry = calloc(1, sizeof(FontEntry));
+  char *name = strdup(font_name);
+  if (!entry || !name) {
+    printf("Error: Failed to allocate font\n");
+    free(entry);
+    free(name);
+    g_bytes_unref(data);
+    return NULL;
+  }
+  const unsigned char *bytes = g_bytes_get_data(data, NULL);
+  if (!stbtt_InitFont(&entry->info, bytes,
+                      stbtt_GetFontOffsetForIndex(bytes, 0))) {
+    printf("Error: Failed to initialize font\n");
+    free(entry);
+    free(name);
+    g_bytes_unref(data);
+    return NULL;
+  }
+  entry->name = name;
+  entry->data = data;
+  return entry;
+}
+
+const stbtt_fontinfo *font_registry_get(const char *font_name) {
+  pthread_mutex_lock(&fonts_lock);
+  FontEntry *entry = fonts;
+  while (entry && strcmp(entry->name, font_name)) {
+    entry = entry->next;
+  }
+  if (!entry) {
+    entry = load_font(font_name);
+    if (entry) {
+      entry->next = fonts;
+      fonts = entry;
+    }
+  }
+  pthread_mutex_unlock(&fonts_lock);
+  return entry ? &entry->info : NULL;
+}
@@ -0,0 +1,134 @@
+#include <glyph_atlas.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STB_RECT_PACK_IMPLEMENTATION
+#include "stb/stb_rect_pack.h"
+
+// blank pixels between glyphs so a blit never reads its neighbour
+#define ATLAS_PADDING 1
+
+// the atlas is a square-ish strip wide enough for the widest glyph, its
+// height is cut down to what the packer used
+static int pack_glyphs(stbrp_rect *rects, int count, int *width,
+                       int *height) {
+  int area = 0, max_w = 0, total_h = 0;
+  for (int i = 0; i < count; i++) {
+    area += rects[i].w * rects[i].h;
+    max_w = rects[i].w > max_w ? rects[i].w : max_w;
+    total_h += rects[i].h;
+  }
+  int w = (int)ceil(sqrt((double)area));
+  w = w > max_w ? w : max_w;
+  w = w > 0 ? w : 1;
+
+  stbrp_node *nodes = malloc(w * sizeof(stbrp_node));
+  if (!nodes) {
+    return 1;
+  }
+  stbrp_context context;
+  stbrp_init_target(&context, w, total_h > 0 ? total_h : 1, nodes, w);
+  int packed = stbrp_pack_rects(&context, rects, count);
+  free(nodes);
+  if (!packed) {
+    return 1;
+  }
+
+  int h = 1;
+  for (int i = 0; i < count; i++) {
+    h = rects[i].y + rects[i].h > h ? rects[i].y + rects[i].h : h;
+  }
+  *width = w;
+  *height = h;
+  return 0;
+}
+
+// repeat every coverage byte `channels` times, in place from the end
+static void expand_channels(uint8_t *pixels, size_t count, int channels) {
+  for (size_t i = count; i-- > 0;) {
+    for (int k = channels - 1; k >= 0; k--) {
+      pixels[i * channels + k] = pixels[i];
+    }
+  }
+}
+
+GlyphAtlas *glyph_atlas_new(const stbtt_fontinfo *font, float pixel_height,
+                            const int *codepoints, int count, int channels) {
+  GlyphAtlas *atlas = calloc(1, sizeof(GlyphAtlas));
+  AtlasGlyph *glyphs = calloc(count, sizeof(AtlasGlyph));
+  stbrp_rect *rects = calloc(count, sizeof(stbrp_rect));
+  if (!atlas || !glyphs || !rects) {
+    printf("Error: Failed to allocate glyph atlas\n");
+    free(atlas);
+    free(glyphs);
+    free(rects);
+    return NULL;
+  }
+  atlas->font = font;
+  atlas->pixel_height = pixel_height;
+  atlas->scale = stbtt_ScaleForPixelHeight(font, pixel_height);
+  atlas->channels = channels;
+  atlas->count = count;
+  atlas->glyphs = glyphs;
+
+  for (int i = 0; i < count; i++) {
+    AtlasGlyph *glyph = &glyphs[i];
+    int advance, lsb, x0, y0, x1, y1;
+    stbtt_GetCodepointHMetrics(font, codepoints[i], &advance, &lsb);
+    stbtt_GetCodepointBitmapBox(font, codepoints[i], atlas->scale,
+                                atlas->scale, &x0, &y0, &x1, &y1);
+    glyph->codepoint = codepoints[i];
+    glyph->w = x1 - x0;
+    glyph->h = y1 - y0;
+    glyph->xoff = x0;
+    glyph->yoff = y0;
+    glyph->advance = (int)(advance * atlas->scale);
+    rects[i].id = i;
+    rects[i].w = glyph->w + ATLAS_PADDING;
+    rects[i].h = glyph->h + ATLAS_PADDING;
+  }
+
+  if (pack_glyphs(rects, count, &atlas->width, &atlas->height)) {
+    printf("Error: Failed to pack glyph atlas\n");
+    free(rects);
+    glyph_atlas_free(atlas);
+    return NULL;
+  }
+  atlas->pixels = calloc((size_t)atlas->width * atlas->height, channels);
+  if (!atlas->pixels) {
+    printf("Error: Failed to allocate glyph atlas\n");
+    free(rects);
+    glyph_atlas_free(atlas);
+    return NULL;
+  }
+
+  // every glyph is rasterized once, straight into its place in the atlas
+  for (int i = 0; i < count; i++) {
+    AtlasGlyph *glyph = &glyphs[rects[i].id];
+    glyph->x = rects[i].x;
+    glyph->y = rects[i].y;
+    if (glyph->w > 0 && glyph->h > 0) {
+      stbtt_MakeCodepointBitmap(
+          font, atlas->pixels + (size_t)glyph->y * atlas->width + glyph->x,
+          glyph->w, glyph->h, atlas->width, atlas->scale, atlas->scale,
+          glyph->codepoint);
+    }
+  }
+  free(rects);
+  if (channels > 1) {
+    expand_channels(atlas->pixels, (size_t)atlas->width * atlas->height,
+                    channels);
+  }
+  return atlas;
+}
+
+void glyph_atlas_free(GlyphAtlas *atlas) {
+  if (!atlas) {
+    return;
+  }
+  free(atlas->pixels);
+  free(atlas->glyphs);
+  free(atlas);
+}
@@ -0,0 +1,256 @@
+#include <glyph_kernel.h>
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GLYPH_KERNEL_X86
+#endif
+
+// (r + g + b) / 3 as (sum * LUMA_MUL) >> 16, exact for every sum <= 765
+#define LUMA_MUL 21846
+// luma * (GRADIENT_SIZE - 1) / 255 as (luma * INDEX_MUL) >> 16, exact for
+// every luma <= 255, the SIMD paths use it instead of the lookup table
+#define INDEX_MUL 3856
+
+typedef int (*IndicesKernel)(const uint8_t *pixels, int channels, int count,
+                             uint8_t *indices);
+
+static uint8_t index_lut[256];
+static IndicesKernel simd_kernel = NULL;
+static const char *kernel_name = "scalar";
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+static void indices_scalar(const uint8_t *pixels, int channels, int count,
+                           uint8_t *indices) {
+  if (channels == 1) {
+    for (int i = 0; i < count; i++) {
+      indices[i] = index_lut[pixels[i]];
+    }
+    return;
+  }
+  for (int i = 0; i < count; i++) {
+    const uint8_t *p = pixels + (size_t)i * channels;
+    unsigned sum = p[0] + p[1] + p[2];
+    indices[i] = index_lut[(sum * LUMA_MUL) >> 16];
+  }
+}
+
+#ifdef GLYPH_KERNEL_X86
+// split 16 packed RGB pixels into three planes with SSE2 unpacks only
+__attribute__((target("sse2"))) static inline void
+deinterleave_rgb_sse2(const uint8_t *src, __m128i *r, __m128i *g,
+                      __m128i *b) {
+  __m128i t00 = _mm_loadu_si128((const __m128i *)src);
+  __m128i t01 = _mm_loadu_si128((const __m128i *)(src + 16));
+  __m128i t02 = _mm_loadu_si128((const __m128i *)(src + 32));
+
+  __m128i t10 = _mm_unpacklo_epi8(t00, _mm_unpackhi_epi64(t01, t01));
+  __m128i t11 = _mm_unpacklo_epi8(_mm_unpackhi_epi64(t00, t00), t02);
+  __m128i t12 = _mm_unpacklo_epi8(t01, _mm_unpackhi_epi64(t02, t02));
+
+  __m128i t20 = _mm_unpacklo_epi8(t10, _mm_unpackhi_epi64(t11, t11));
+  __m128i t21 = _mm_unpacklo_epi8(_mm_unpackhi_epi64(t10, t10), t12);
+  __m128i t22 = _mm_unpacklo_epi8(t11, _mm_unpackhi_epi64(t12, t12));
+
+  __m128i t30 = _mm_unpacklo_epi8(t20, _mm_unpackhi_epi64(t21, t21));
+  __m128i t31 = _mm_unpacklo_epi8(_mm_unpackhi_epi64(t20, t20), t22);
+  __m128i t32 = _mm_unpacklo_epi8(t21, _mm_unpackhi_epi64(t22, t22));
+
+  *r = _mm_unpacklo_epi8(t30, _mm_unpackhi_epi64(t31, t31));
+  *g = _mm_unpacklo_epi8(_mm_unpackhi_epi64(t30, t30), t32);
+  *b = _mm_unpacklo_epi8(t31, _mm_unpackhi_epi64(t32, t32));
+}
+
+// r + g + b of the four RGBA pixels in v, one per 32 bit lane
+__attribute__((target("sse2"))) static inline __m128i
+sum_rgba_sse2(__m128i v) {
+  __m128i mask = _mm_set1_epi32(0xff);
+  __m128i r = _mm_and_si128(v, mask);
+  __m128i g = _mm_and_si128(_mm_srli_epi32(v, 8), mask);
+  __m128i b = _mm_and_si128(_mm_srli_epi32(v, 16), mask);
+  return _mm_add_epi32(_mm_add_epi32(r, g), b);
+}
+
+__attribute__((target("sse2"))) static inline __m128i
+sums_to_indices_sse2(__m128i sum) {
+  __m128i luma = _mm_mulhi_epu16(sum, _mm_set1_epi16(LUMA_MUL));
+  return _mm_mulhi_epu16(luma, _mm_set1_epi16(INDEX_MUL));
+}
+
+__attribute__((target("sse2"))) static int
+indices_sse2(const uint8_t *pixels, int channels, int count,
+             uint8_t *indices) {
+  __m128i zero = _mm_setzero_si128();
+  int i = 0;
+  if (channels == 1) {
+    __m128i mul = _mm_set1_epi16(INDEX_MUL);
+    for (; i + 16 <= count; i += 16) {
+      __m128i luma = _mm_loadu_si128((const __m128i *)(pixels + i));
+      __m128i lo = _mm_mulhi_epu16(_mm_unpacklo_epi8(luma, zero), mul);
+      __m128i hi = _mm_mulhi_epu16(_mm_unpackhi_epi8(luma, zero), mul);
+      _mm_storeu_si128((__m128i *)(indices + i), _mm_packus_epi16(lo, hi));
+    }
+    return i;
+  }
+  for (; i + 16 <= count; i += 16) {
+    const uint8_t *src = pixels + (size_t)i * channels;
+    __m128i sum_lo, sum_hi;
+    if (channels == 3) {
+      __m128i r, g, b;
+      deinterleave_rgb_sse2(src, &r, &g, &b);
+      sum_lo = _mm_add_epi16(
+          _mm_add_epi16(_mm_unpacklo_epi8(r, zero), _mm_unpacklo_epi8(g, zero)),
+          _mm_unpacklo_epi8(b, zero));
+      sum_hi = _mm_add_epi16(
+          _mm_add_epi16(_mm_unpackhi_epi8(r, zero), _mm_unpackhi_epi8(g, zero)),
+          _mm_unpackhi_epi8(b, zero));
+    } else {
+      __m128i s0 = sum_rgba_sse2(_mm_loadu_si128((const __m128i *)src));
+      __m128i s1 = sum_rgba_sse2(_mm_loadu_si128((const __m128i *)(src + 16)));
+      __m128i s2 = sum_rgba_sse2(_mm_loadu_si128((const __m128i *)(src + 32)));
+      __m128i s3 = sum_rgba_sse2(_mm_loadu_si128((const __m128i *)(src + 48)));
+      sum_lo = _mm_packs_epi32(s0, s1);
+      sum_hi = _mm_packs_epi32(s2, s3);
+    }
+    __m128i out = _mm_packus_epi16(sums_to_indices_sse2(sum_lo),
+                                   sums_to_indices_sse2(sum_hi));
+    _mm_storeu_si128((__m128i *)(indices + i), out);
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) static inline __m256i
+sum_rgba_avx2(__m256i v) {
+  __m256i mask = _mm256_set1_epi32(0xff);
+  __m256i r = _mm256_and_si256(v, mask);
+  __m256i g = _mm256_and_si256(_mm256_srli_epi32(v, 8), mask);
+  __m256i b = _mm256_and_si256(_mm256_srli_epi32(v, 16), mask);
+  return _mm256_add_epi32(_mm256_add_epi32(r, g), b);
+}
+
+__attribute__((target("avx2"))) static inline __m256i
+sums_to_indices_avx2(__m256i sum) {
+  __m256i luma = _mm256_mulhi_epu16(sum, _mm256_set1_epi16(LUMA_MUL));
+  return _mm256_mulhi_epu16(luma, _mm256_set1_epi16(INDEX_MUL));
+}
+
+__attribute__((target("avx2"))) static int
+indices_avx2(const uint8_t *pixels, int channels, int count,
+             uint8_t *indices) {
+  int i = 0;
+  if (channels == 1) {
+    __m256i mul = _mm256_set1_epi16(INDEX_MUL);
+    for (; i + 32 <= count; i += 32) {
+      __m128i lo = _mm_loadu_si128((const __m128i *)(pixels + i));
+      __m128i hi = _mm_loadu_si128((const __m128i *)(pixels + i + 16));
+      __m256i idx_lo = _mm256_mulhi_epu16(_mm256_cvtepu8_epi16(lo), mul);
+      __m256i idx_hi = _mm256_mulhi_epu16(_mm256_cvtepu8_epi16(hi), mul);
+      // packs work inside each 128 bit lane, put the quadwords back in order
+      __m256i out = _mm256_permute4x64_epi64(
+          _mm256_packus_epi16(idx_lo, idx_hi), _MM_SHUFFLE(3, 1, 2, 0));
+      _mm256_storeu_si256((__m256i *)(indices + i), out);
+    }
+  } else if (channels == 3) {
+    // pshufb masks gathering one channel of 16 RGB pixels out of 48 bytes
+    const __m128i plane_masks[3][3] = {
+        {_mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                       -1),
+         _mm_setr_epi8(-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1,
+                       -1),
+         _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10,
+                       13)},
+        {_mm_setr_epi8(1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                       -1),
+         _mm_setr_epi8(-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1,
+                       -1),
+         _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11,
+                       14)},
+        {_mm_setr_epi8(2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                       -1),
+         _mm_setr_epi8(-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1,
+                       -1),
+         _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12,
+                       15)},
+    };
+    for (; i + 16 <= count; i += 16) {
+      const uint8_t *src = pixels + (size_t)i * 3;
+      __m128i v[3] = {_mm_loadu_si128((const __m128i *)src),
+                      _mm_loadu_si128((const __m128i *)(src + 16)),
+                      _mm_loadu_si128((const __m128i *)(src + 32))};
+      __m256i sum = _mm256_setzero_si256();
+      for (int c = 0; c < 3; c++) {
+        __m128i plane = _mm_or_si128(
+            _mm_or_si128(_mm_shuffle_epi8(v[0], plane_masks[c][0]),
+                         _mm_shuffle_epi8(v[1], plane_masks[c][1])),
+            _mm_shuffle_epi8(v[2], plane_masks[c][2]));
+        sum = _mm256_add_epi16(sum, _mm256_cvtepu8_epi16(plane));
+      }
+      __m256i idx = sums_to_indices_avx2(sum);
+      __m128i out = _mm_packus_epi16(_mm256_castsi256_si128(idx),
+                                     _mm256_extracti128_si256(idx, 1));
+      _mm_storeu_si128((__m128i *)(indices + i), out);
+    }
+  } else {
+    // packs work inside each 128 bit lane, this puts the dwords back in order
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    for (; i + 32 <= count; i += 32) {
+      const __m256i *src = (const __m256i *)(pixels + (size_t)i * 4);
+      __m256i s0 = sum_rgba_avx2(_mm256_loadu_si256(src));
+      __m256i s1 = sum_rgba_avx2(_mm256_loadu_si256(src + 1));
+      __m256i s2 = sum_rgba_avx2(_mm256_loadu_si256(src + 2));
+      __m256i s3 = sum_rgba_avx2(_mm256_loadu_si256(src + 3));
+      __m256i out =
+          _mm256_packus_epi16(sums_to_indices_avx2(_mm256_packs_epi32(s0, s1)),
+                              sums_to_indices_avx2(_mm256_packs_epi32(s2, s3)));
+      out = _mm256_permutevar8x32_epi32(out, order);
+      _mm256_storeu_si256((__m256i *)(indices + i), out);
+    }
+  }
+  return i;
+}
+#endif
+
+// build the index table and pick the widest kernel the cpu supports
+static void select_kernel(void) {
+  for (int i = 0; i < 256; i++) {
+    index_lut[i] = i * (GRADIENT_SIZE - 1) / 255;
+  }
+#ifdef GLYPH_KERNEL_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    simd_kernel = indices_avx2;
+    kernel_name = "avx2";
+  } else if (__builtin_cpu_supports("sse2")) {
+    simd_kernel = indices_sse2;
+    kernel_name = "sse2";
+  }
+#endif
+}
+
+void pixels_to_glyphs(const uint8_t *pixels, int channels, int count,
+                      uint8_t *indices, uint8_t *colors) {
+  pthread_once(&kernel_once, select_kernel);
+
+  int done = simd_kernel ? simd_kernel(pixels, channels, count, indices) : 0;
+  indices_scalar(pixels + (size_t)done * channels, channels, count - done,
+                 indices + done);
+
+  if (!colors || colors == pixels) {
+    return;
+  }
+  if (channels == 3) {
+    memcpy(colors, pixels, (size_t)count * 3);
+    return;
+  }
+  for (int i = 0; i < count; i++) {
+    colors[i * 3] = pixels[i * 4];
+    colors[i * 3 + 1] = pixels[i * 4 + 1];
+    colors[i * 3 + 2] = pixels[i * 4 + 2];
+  }
+}
+
+const char *glyph_kernel_name(void) {
+  pthread_once(&kernel_once, select_kernel);
+  return kernel_name;
+}
@@ -0,0 +1,154 @@
+#include <image_cache.h>
+#include <image_loader.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+ImageCache *image_cache_new(size_t budget) {
+  ImageCache *cache = calloc(1, sizeof(ImageCache));
+  if (!cache) {
+    return NULL;
+  }
+  cache->budget = budget;
+  return cache;
+}
+
+static void unlink_entry(ImageCache *cache, ImageCacheEntry *entry) {
+  if (entry->prev) {
+    entry->prev->next = entry->next;
+  } else {
+    cache->head = entry->next;
+  }
+  if (entry->next) {
+    entry->next->prev = entry->prev;
+  } else {
+    cache->tail = entry->prev;
+  }
+  entry->prev = entry->next = NULL;
+}
+
+static void push_front(ImageCache *cache, ImageCacheEntry *entry) {
+  entry->next = cache->head;
+  if (cache->head) {
+    cache->head->prev = entry;
+  } else {
+    cache->tail = entry;
+  }
+  cache->head = entry;
+}
+
+// a conversion that still holds the load keeps it alive after this
+static void drop_entry(ImageCache *cache, ImageCacheEntry *entry) {
+  unlink_entry(cache, entry);
+  image_load_unref(entry->load);
+  free(entry->path);
+  free(entry);
+}
+
+static bool decode_failed(ImageLoad *load) {
+  pthread_mutex_lock(&load->lock);
+  bool failed = load->done && !load->pixels && !load->streamed;
+  pthread_mutex_unlock(&load->lock);
+  return failed;
+}
+
+// same smallest size image_load_start asks the decoders for, an entry
+// decoded for smaller grids has too few pixels
+static bool covers_scale(const ImageLoad *load, double max_scale_w,
+                         double max_scale_h) {
+  int min_w = (int)ceil(load->width * max_scale_w);
+  int min_h = (int)ceil(load->height * max_scale_h);
+  min_w = min_w < load->width ? min_w : load->width;
+  min_h = min_h < load->height ? min_h : load->height;
+  return load->min_w >= min_w && load->min_h >= min_h;
+}
+
+static ImageCacheEntry *find_entry(ImageCache *cache, const char *filepath,
+                                   const struct stat *st, bool grayscale) {
+  for (ImageCacheEntry *entry = cache->head; entry; entry = entry->next) {
+    if (!strcmp(entry->path, filepath) &&
+        entry->mtime.tv_sec == st->st_mtim.tv_sec &&
+        entry->mtime.tv_nsec == st->st_mtim.tv_nsec &&
+        entry->size == st->st_size && entry->grayscale == grayscale) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+// the head is the image in use, everything behind it goes from the least
+// recently used until the rest fits
+static void evict(ImageCache *cache) {
+  size_t used = 0;
+  for (ImageCacheEntry *entry = cache->head; entry; entry = entry->next) {
+    used += image_load_size(entry->load);
+  }
+  while (used > cache->budget && cache->tail != cache->head) {
+    ImageCacheEntry *entry = cache->tail;
+    size_t size = image_load_size(entry->load);
+    printf("Dropped %s from the image cache (%zu bytes)\n", entry->path,
+           size);
+    drop_entry(cache, entry);
+    used -= size < used ? size : used;
+  }
+}
+
+ImageLoad *image_cache_open(ImageCache *cache, const char *filepath,
+                            size_t memory_budget, double max_scale_w,
+                            double max_scale_h, bool grayscale) {
+  struct stat st;
+  if (strcmp(filepath, "-") == 0 || stat(filepath, &st) ||
+      !S_ISREG(st.st_mode)) {
+    return image_load_start(filepath, memory_budget, max_scale_w,
+                            max_scale_h, grayscale);
+  }
+
+  // failed decodes are retried, the file may have been fixed in place
+  ImageCacheEntry *entry = find_entry(cache, filepath, &st, grayscale);
+  if (entry && (decode_failed(entry->load) ||
+                !covers_scale(entry->load, max_scale_w, max_scale_h))) {
+    drop_entry(cache, entry);
+    entry = NULL;
+  }
+  if (entry) {
+    printf("Reusing the decoded image of %s\n", filepath);
+    unlink_entry(cache, entry);
+    push_front(cache, entry);
+    evict(cache);
+    return image_load_ref(entry->load);
+  }
+
+  ImageLoad *load = image_load_start(filepath, memory_budget, max_scale_w,
+                                     max_scale_h, grayscale);
+  if (!load) {
+    return NULL;
+  }
+  entry = calloc(1, sizeof(ImageCacheEntry));
+  char *path = strdup(filepath);
+  if (!entry || !path) {
+    // still usable, just not cached
+    free(entry);
+    free(path);
+    return load;
+  }
+  entry->path = path;
+  entry->mtime = st.st_mtim;
+  entry->size = st.st_size;
+  entry->grayscale = grayscale;
+  entry->load = image_load_ref(load);
+  push_front(cache, entry);
+  evict(cache);
+  return load;
+}
+
+void image_cache_free(ImageCache *cache) {
+  if (!cache) {
+    return;
+  }
+  while (cache->head) {
+    drop_entry(cache, cache->head);
+  }
+  free(cache);
+}
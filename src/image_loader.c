@@ -0,0 +1,419 @@
+#include "stb/stb_image.h"
+#include <fcntl.h>
+#include <image_loader.h>
+#include <jpeg_decoder.h>
+#include <limits.h>
+#include <mapped_file.h>
+#include <math.h>
+#include <sampler.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stream_reader.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <tone_map.h>
+#include <unistd.h>
+#include <webp_decoder.h>
+
+// stb takes the length of an in-memory image as an int, bigger files are
+// fed to it from the mapping through callbacks instead
+typedef struct {
+  const uint8_t *data;
+  size_t size, pos;
+} MemoryReader;
+
+static int memory_read(void *user, char *data, int size) {
+  MemoryReader *reader = (MemoryReader *)user;
+  size_t left = reader->size - reader->pos;
+  size_t n = (size_t)size < left ? (size_t)size : left;
+  memcpy(data, reader->data + reader->pos, n);
+  reader->pos += n;
+  return (int)n;
+}
+
+static void memory_skip(void *user, int n) {
+  MemoryReader *reader = (MemoryReader *)user;
+  // stb may skip backwards to put back bytes it peeked at
+  if (n < 0 && (size_t)-n > reader->pos) {
+    reader->pos = 0;
+  } else if (n > 0 && (size_t)n > reader->size - reader->pos) {
+    reader->pos = reader->size;
+  } else {
+    reader->pos += n;
+  }
+}
+
+static int memory_eof(void *user) {
+  MemoryReader *reader = (MemoryReader *)user;
+  return reader->pos >= reader->size;
+}
+
+static const stbi_io_callbacks memory_callbacks = {memory_read, memory_skip,
+                                                   memory_eof};
+
+static int image_info(const MappedFile *file, int *width, int *height,
+                      int *channels) {
+  if (file->size <= INT_MAX) {
+    if (stbi_info_from_memory(file->data, (int)file->size, width, height,
+                              channels)) {
+      return 1;
+    }
+  } else {
+    MemoryReader reader = {file->data, file->size, 0};
+    if (stbi_info_from_callbacks(&memory_callbacks, &reader, width, height,
+                                 channels)) {
+      return 1;
+    }
+  }
+  // stb_image doesn't know about WebP
+  return webp_info(file, width, height, channels);
+}
+
+// where stb reads the image from, the mapping itself while stb can take its
+// length, callbacks over the mapping or the stream otherwise
+typedef struct {
+  const MappedFile *file;
+  const stbi_io_callbacks *io;
+  void *user;
+  MemoryReader reader;
+} StbInput;
+
+static void stb_input_init(StbInput *in, const MappedFile *file,
+                           StreamReader *stream) {
+  in->file = file && file->size <= INT_MAX ? file : NULL;
+  if (stream) {
+    in->io = &stream_reader_callbacks;
+    in->user = stream;
+  } else {
+    in->reader = (MemoryReader){file->data, file->size, 0};
+    in->io = &memory_callbacks;
+    in->user = &in->reader;
+  }
+}
+
+// callbacks are consumed by every query, each one starts from the top
+static void *stb_input_rewind(StbInput *in) {
+  if (in->io == &stream_reader_callbacks) {
+    stream_reader_rewind(in->user);
+  } else {
+    in->reader.pos = 0;
+  }
+  return in->user;
+}
+
+static int stb_is_hdr(StbInput *in) {
+  if (in->file) {
+    return stbi_is_hdr_from_memory(in->file->data, (int)in->file->size);
+  }
+  return stbi_is_hdr_from_callbacks(in->io, stb_input_rewind(in));
+}
+
+static int stb_is_16_bit(StbInput *in) {
+  if (in->file) {
+    return stbi_is_16_bit_from_memory(in->file->data, (int)in->file->size);
+  }
+  return stbi_is_16_bit_from_callbacks(in->io, stb_input_rewind(in));
+}
+
+// give back what a wider sample type used once it has been reduced in place
+static uint8_t *shrink_pixels(void *pixels, size_t size) {
+  uint8_t *shrunk = realloc(pixels, size ? size : 1);
+  return shrunk ? shrunk : pixels;
+}
+
+// req_channels is 0 to keep the channels of the file, 1 or 2 for grayscale.
+// 16 bit and HDR images are decoded at full precision and reduced to 8 bit
+// here, rounded or tone mapped instead of truncated by stb
+static uint8_t *image_decode(StbInput *in, int req_channels, int *width,
+                             int *height, int *channels) {
+  const stbi_uc *data = in->file ? in->file->data : NULL;
+  int len = in->file ? (int)in->file->size : 0;
+  if (stb_is_hdr(in)) {
+    float *hdr = data ? stbi_loadf_from_memory(data, len, width, height,
+                                               channels, req_channels)
+                      : stbi_loadf_from_callbacks(in->io, stb_input_rewind(in),
+                                                  width, height, channels,
+                                                  req_channels);
+    if (!hdr) {
+      return NULL;
+    }
+    int out_channels = req_channels ? req_channels : *channels;
+    size_t count = (size_t)*width * *height;
+    hdr_to_8(hdr, count, out_channels, (uint8_t *)hdr);
+    return shrink_pixels(hdr, count * out_channels);
+  }
+  if (stb_is_16_bit(in)) {
+    uint16_t *wide = data ? stbi_load_16_from_memory(data, len, width, height,
+                                                     channels, req_channels)
+                          : stbi_load_16_from_callbacks(
+                                in->io, stb_input_rewind(in), width, height,
+                                channels, req_channels);
+    if (!wide) {
+      return NULL;
+    }
+    size_t samples = (size_t)*width * *height *
+                     (req_channels ? req_channels : *channels);
+    samples16_to_8(wide, samples, (uint8_t *)wide);
+    return shrink_pixels(wide, samples);
+  }
+  if (data) {
+    return stbi_load_from_memory(data, len, width, height, channels,
+                                 req_channels);
+  }
+  return stbi_load_from_callbacks(in->io, stb_input_rewind(in), width, height,
+                                  channels, req_channels);
+}
+
+// the bytes of a stream read so far, seen as a file
+static MappedFile stream_view(const StreamReader *stream) {
+  MappedFile view = {stream->data, stream->size};
+  return view;
+}
+
+// a mapped JPEG whose decoded pixels alone break the budget isn't decoded
+// here, each conversion decodes it again a band of rows at a time
+static bool stream_jpeg(const ImageLoad *load, int *width, int *height,
+                        int *channels) {
+  if (!load->memory_budget || !load->file) {
+    return false;
+  }
+  JpegReader *reader =
+      jpeg_reader_open(load->file, load->min_w, load->min_h, load->grayscale,
+                       width, height, channels);
+  if (!reader) {
+    return false;
+  }
+  jpeg_reader_close(reader);
+  return (size_t)*width * *height * *channels > load->memory_budget;
+}
+
+static void *decode_worker(void *arg) {
+  ImageLoad *load = (ImageLoad *)arg;
+  int width = 0, height = 0, channels = 0;
+  uint8_t *pixels = NULL;
+  bool streamed = stream_jpeg(load, &width, &height, &channels);
+  // the scaled decoders need the whole file, stb reads any other stream
+  // while it decodes
+  MappedFile view;
+  const MappedFile *file = load->file;
+  if (load->stream && load->read_whole_stream &&
+      !stream_reader_drain(load->stream)) {
+    view = stream_view(load->stream);
+    file = &view;
+  }
+
+  // JPEG and WebP can be decoded straight to a fraction of their size, the
+  // full resolution would only be averaged away by the cells
+  if (file && !streamed) {
+    pixels = jpeg_decode_scaled(file, load->min_w, load->min_h,
+                                load->grayscale, &width, &height, &channels);
+  }
+  if (file && !streamed && !pixels) {
+    pixels = webp_decode_scaled(file, load->min_w, load->min_h,
+                                load->grayscale, &width, &height, &channels);
+  }
+  int req_channels = load->grayscale ? load->channels : 0;
+  if (streamed) {
+    printf("Decoding %d x %d px image at %d x %d px a band at a time, it "
+           "doesn't fit the memory budget\n",
+           load->width, load->height, width, height);
+  } else if (pixels) {
+    printf("Decoded %d x %d px image at %d x %d px\n", load->width,
+           load->height, width, height);
+  } else {
+    StbInput in;
+    stb_input_init(&in, file, file ? NULL : load->stream);
+    pixels = image_decode(&in, req_channels, &width, &height, &channels);
+  }
+  // stb reports the channels of the file, not the ones it converted to
+  if (pixels && req_channels) {
+    channels = req_channels;
+  }
+  if (!pixels && !streamed) {
+    printf("Error: Failed to decode image: %s\n", stbi_failure_reason());
+  } else if (width > load->width || height > load->height ||
+             width < load->min_w || height < load->min_h ||
+             channels != load->channels) {
+    printf("Error: Decoded image doesn't match its header\n");
+    stbi_image_free(pixels);
+    pixels = NULL;
+    streamed = false;
+  }
+  if (!streamed) {
+    mapped_file_close(load->file);
+    load->file = NULL;
+  }
+  stream_reader_free(load->stream);
+  load->stream = NULL;
+
+  // integral image of the input, every output size is then sampled with four
+  // lookups per cell instead of walking the whole image again. It is four
+  // times the size of an RGB image so it is skipped if it breaks the budget
+  SummedAreaTable *sat = NULL;
+  int entry = (load->grayscale ? 1 : 3) + (channels == 2 || channels == 4);
+  size_t image_size = (size_t)width * height * channels;
+  if (pixels &&
+      (!load->memory_budget || image_size + sat_size(width, height, entry) <=
+                                   load->memory_budget)) {
+    sat = sat_build(pixels, width, height, channels,
+                    load->grayscale ? 1 : 3);
+  }
+  // without the table the conversion walks the pixels, the reduced levels
+  // (a third of the image) keep that walk close to the size of the grid
+  ImagePyramid *pyramid = NULL;
+  if (pixels && !sat &&
+      (!load->memory_budget ||
+       image_size + image_size / 3 <= load->memory_budget)) {
+    pyramid = pyramid_build(pixels, width, height, channels);
+  }
+
+  pthread_mutex_lock(&load->lock);
+  load->pixels = pixels;
+  load->streamed = streamed;
+  load->pixels_w = width;
+  load->pixels_h = height;
+  load->sat = sat;
+  load->pyramid = pyramid;
+  load->done = true;
+  pthread_cond_broadcast(&load->changed);
+  pthread_mutex_unlock(&load->lock);
+  // the load may have been dropped while it was decoding
+  image_load_unref(load);
+  return NULL;
+}
+
+// regular files are mapped, stdin ("-"), pipes and other descriptors that
+// can't be mapped are read as a stream
+static int open_input(ImageLoad *load, const char *filepath) {
+  int fd = strcmp(filepath, "-") ? open(filepath, O_RDONLY) : dup(STDIN_FILENO);
+  if (fd < 0) {
+    perror("Error opening file");
+    return -1;
+  }
+  struct stat st;
+  if (!fstat(fd, &st) && S_ISREG(st.st_mode)) {
+    load->file = mapped_file_open_fd(fd);
+    close(fd);
+    return load->file ? 0 : -1;
+  }
+  load->stream = stream_reader_new(fd);
+  return load->stream ? 0 : -1;
+}
+
+static int input_info(ImageLoad *load) {
+  if (load->file) {
+    return image_info(load->file, &load->width, &load->height,
+                      &load->channels);
+  }
+  StreamReader *stream = load->stream;
+  int found = stbi_info_from_callbacks(&stream_reader_callbacks, stream,
+                                       &load->width, &load->height,
+                                       &load->channels);
+  stream_reader_rewind(stream);
+  // the header is in the first bytes read for any format
+  MappedFile view = stream_view(stream);
+  bool webp =
+      !found && webp_info(&view, &load->width, &load->height, &load->channels);
+  bool jpeg = view.size >= 3 && view.data[0] == 0xFF && view.data[1] == 0xD8 &&
+              view.data[2] == 0xFF;
+  load->read_whole_stream = webp || jpeg;
+  return found || webp;
+}
+
+ImageLoad *image_load_start(const char *filepath, size_t memory_budget,
+                            double max_scale_w, double max_scale_h,
+                            bool grayscale) {
+  ImageLoad *load = calloc(1, sizeof(ImageLoad));
+  if (!load) {
+    return NULL;
+  }
+  if (open_input(load, filepath)) {
+    free(load);
+    return NULL;
+  }
+  // only the header is parsed here, the decode reads the same mapping or
+  // stream buffer without opening the file again
+  if (!input_info(load)) {
+    printf("Error: Unsupported image format\n");
+    mapped_file_close(load->file);
+    stream_reader_free(load->stream);
+    free(load);
+    return NULL;
+  }
+  // the caller's reference and the decode's own one, the thread is detached
+  // so whoever drops the last one frees the load without waiting
+  load->refs = 2;
+  load->memory_budget = memory_budget;
+  load->grayscale = grayscale;
+  // gray keeps the alpha of the file so it can be composited on the
+  // background like the colors are
+  if (grayscale) {
+    load->channels = load->channels == 2 || load->channels == 4 ? 2 : 1;
+  }
+  load->min_w = (int)ceil(load->width * max_scale_w);
+  load->min_h = (int)ceil(load->height * max_scale_h);
+  load->min_w = load->min_w < load->width ? load->min_w : load->width;
+  load->min_h = load->min_h < load->height ? load->min_h : load->height;
+  pthread_mutex_init(&load->lock, NULL);
+  pthread_cond_init(&load->changed, NULL);
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, decode_worker, load)) {
+    printf("Error: Failed to start the image decode\n");
+    pthread_mutex_destroy(&load->lock);
+    pthread_cond_destroy(&load->changed);
+    mapped_file_close(load->file);
+    stream_reader_free(load->stream);
+    free(load);
+    return NULL;
+  }
+  pthread_detach(thread);
+  return load;
+}
+
+int image_load_wait(ImageLoad *load) {
+  pthread_mutex_lock(&load->lock);
+  while (!load->done) {
+    pthread_cond_wait(&load->changed, &load->lock);
+  }
+  pthread_mutex_unlock(&load->lock);
+  return load->pixels || load->streamed ? 0 : -1;
+}
+
+ImageLoad *image_load_ref(ImageLoad *load) {
+  __atomic_fetch_add(&load->refs, 1, __ATOMIC_RELAXED);
+  return load;
+}
+
+size_t image_load_size(ImageLoad *load) {
+  pthread_mutex_lock(&load->lock);
+  // until the decode is over count the full size image, the most it can take
+  size_t size = (size_t)load->width * load->height * load->channels;
+  if (load->done && load->streamed) {
+    // only the mapping of the file, its pages can be dropped at any time
+    size = 0;
+  } else if (load->done) {
+    size = (size_t)load->pixels_w * load->pixels_h * load->channels;
+    if (load->sat) {
+      size += sat_size(load->pixels_w, load->pixels_h,
+                       load->sat->planes + load->sat->alpha);
+    }
+    if (load->pyramid) {
+      size += pyramid_size(load->pyramid);
+    }
+  }
+  pthread_mutex_unlock(&load->lock);
+  return size;
+}
+
+void image_load_unref(ImageLoad *load) {
+  if (!load || __atomic_sub_fetch(&load->refs, 1, __ATOMIC_ACQ_REL)) {
+    return;
+  }
+  mapped_file_close(load->file);
+  stbi_image_free(load->pixels);
+  sat_free(load->sat);
+  pyramid_free(load->pyramid);
+  pthread_mutex_destroy(&load->lock);
+  pthread_cond_destroy(&load->changed);
+  free(load);
+}
@@ -0,0 +1,185 @@
+#include <jpeg_decoder.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef HAVE_LIBJPEG
+#include <jpeglib.h>
+#include <setjmp.h>
+
+// libjpeg exits the process on errors by default, jump back to the decode
+// instead so the caller can fall back to stb_image
+typedef struct {
+  struct jpeg_error_mgr mgr;
+  jmp_buf jump;
+} JpegError;
+
+static void jpeg_error_exit(j_common_ptr cinfo) {
+  JpegError *error = (JpegError *)cinfo->err;
+  char message[JMSG_LENGTH_MAX];
+  cinfo->err->format_message(cinfo, message);
+  printf("Error: libjpeg: %s\n", message);
+  longjmp(error->jump, 1);
+}
+
+static void jpeg_skip_message(j_common_ptr cinfo, int level) {
+  (void)cinfo;
+  (void)level;
+}
+
+// the smallest of 1/8, 1/4, 1/2 and 1/1 that still covers the cell grid,
+// every output pixel is then the average of a block of input pixels already
+static void pick_scale(struct jpeg_decompress_struct *cinfo, int min_width,
+                       int min_height) {
+  for (unsigned int denom = 8; denom > 1; denom /= 2) {
+    cinfo->scale_num = 1;
+    cinfo->scale_denom = denom;
+    jpeg_calc_output_dimensions(cinfo);
+    if ((int)cinfo->output_width >= min_width &&
+        (int)cinfo->output_height >= min_height) {
+      return;
+    }
+  }
+  cinfo->scale_num = 1;
+  cinfo->scale_denom = 1;
+}
+
+struct JpegReader {
+  struct jpeg_decompress_struct cinfo;
+  JpegError error;
+};
+
+JpegReader *jpeg_reader_open(const MappedFile *file, int min_width,
+                             int min_height, bool grayscale, int *width,
+                             int *height, int *channels) {
+  // SOI marker, anything else is left to stb_image
+  if (file->size < 3 || file->data[0] != 0xFF || file->data[1] != 0xD8 ||
+      file->data[2] != 0xFF) {
+    return NULL;
+  }
+  // volatile so the reader survives the longjmp and can be freed
+  JpegReader *volatile reader = malloc(sizeof(JpegReader));
+  if (!reader) {
+    return NULL;
+  }
+
+  struct jpeg_decompress_struct *cinfo = &reader->cinfo;
+  cinfo->err = jpeg_std_error(&reader->error.mgr);
+  reader->error.mgr.error_exit = jpeg_error_exit;
+  reader->error.mgr.emit_message = jpeg_skip_message;
+  if (setjmp(reader->error.jump)) {
+    jpeg_destroy_decompress(cinfo);
+    free(reader);
+    return NULL;
+  }
+
+  jpeg_create_decompress(cinfo);
+  jpeg_mem_src(cinfo, file->data, file->size);
+  jpeg_read_header(cinfo, TRUE);
+  // CMYK and YCCK images go through stb_image
+  if (cinfo->num_components != 1 && cinfo->num_components != 3) {
+    jpeg_destroy_decompress(cinfo);
+    free(reader);
+    return NULL;
+  }
+  // libjpeg keeps only the Y plane of color images for grayscale output
+  cinfo->out_color_space =
+      cinfo->num_components == 1 || grayscale ? JCS_GRAYSCALE : JCS_RGB;
+  pick_scale(cinfo, min_width, min_height);
+  jpeg_start_decompress(cinfo);
+
+  *width = cinfo->output_width;
+  *height = cinfo->output_height;
+  *channels = cinfo->output_components;
+  return reader;
+}
+
+int jpeg_reader_read(JpegReader *reader, uint8_t *rows, int count) {
+  struct jpeg_decompress_struct *cinfo = &reader->cinfo;
+  if (setjmp(reader->error.jump)) {
+    return -1;
+  }
+  size_t row_bytes = (size_t)cinfo->output_width * cinfo->output_components;
+  for (int i = 0; i < count; i++) {
+    if (cinfo->output_scanline >= cinfo->output_height) {
+      return -1;
+    }
+    JSAMPROW row = rows + i * row_bytes;
+    jpeg_read_scanlines(cinfo, &row, 1);
+  }
+  return 0;
+}
+
+void jpeg_reader_close(JpegReader *reader) {
+  if (!reader) {
+    return;
+  }
+  // also fine halfway through the image, nothing is left to finish
+  jpeg_destroy_decompress(&reader->cinfo);
+  free(reader);
+}
+
+uint8_t *jpeg_decode_scaled(const MappedFile *file, int min_width,
+                            int min_height, bool grayscale, int *width,
+                            int *height, int *channels) {
+  int w, h, c;
+  JpegReader *reader = jpeg_reader_open(file, min_width, min_height,
+                                        grayscale, &w, &h, &c);
+  if (!reader) {
+    return NULL;
+  }
+  uint8_t *pixels = malloc((size_t)w * h * c);
+  if (!pixels) {
+    printf("Error: Failed to allocate image buffer\n");
+    jpeg_reader_close(reader);
+    return NULL;
+  }
+  if (jpeg_reader_read(reader, pixels, h)) {
+    jpeg_reader_close(reader);
+    free(pixels);
+    return NULL;
+  }
+  jpeg_reader_close(reader);
+  *width = w;
+  *height = h;
+  *channels = c;
+  return pixels;
+}
+
+#else
+
+JpegReader *jpeg_reader_open(const MappedFile *file, int min_width,
+                             int min_height, bool grayscale, int *width,
+                             int *height, int *channels) {
+  (void)file;
+  (void)min_width;
+  (void)min_height;
+  (void)grayscale;
+  (void)width;
+  (void)height;
+  (void)channels;
+  return NULL;
+}
+
+int jpeg_reader_read(JpegReader *reader, uint8_t *rows, int count) {
+  (void)reader;
+  (void)rows;
+  (void)count;
+  return -1;
+}
+
+void jpeg_reader_close(JpegReader *reader) { (void)reader; }
+
+uint8_t *jpeg_decode_scaled(const MappedFile *file, int min_width,
+                            int min_height, bool grayscale, int *width,
+                            int *height, int *channels) {
+  (void)file;
+  (void)min_width;
+  (void)min_height;
+  (void)grayscale;
+  (void)width;
+  (void)height;
+  (void)channels;
+  return NULL;
+}
+
+#endif // HAVE_LIBJPEG
@@ -1,108 +1,480 @@
 #include "ascii_gtk.h"
+#include "cell_grid.h"
+#include "glyph_kernel.h"
 #include "gtk/gtk.h"
 #include "gtk/gtkshortcut.h"
+#include "image_loader.h"
+#include "jpeg_decoder.h"
 #include "render.h"
+#include "sampler.h"
+#include "span_compositor.h"
 #include "types.h"
+#include "utils.h"
 #include <pthread.h>
 #include <regex.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <logic.h>
 #include <unistd.h>
 
+static const char gradient[GRADIENT_SIZE] = {
+    '@', '&', '%', '#', '*', '+', '~', '=',
+    '_', '-', ';', ':', '`', '\'', '.', ' '};
+
+// shared state of a conversion, workers take one cell row at a time until
+// next_row runs past end_row. Every row only depends on the input so the
+// result is the same no matter which worker converted it
+typedef struct {
+  const uint8_t *rgb_image;
+  int image_top; // source row at the start of rgb_image, a streamed
+                 // conversion only holds a band of the image
+  const SummedAreaTable *sat;
+  SampleRowFn sample_row; // specialized for the channel count of the image
+  int width;
+  uint8_t bg[3]; // transparent pixels are composited on it, RGB or gray
+  const int *x_bounds, *y_bounds;
+  CellGrid *grid;
+  int next_row, end_row;
+  int done_rows;
+} ConvertJob;
+
+static void *convert_row_worker(void *arg) {
+  ConvertJob *job = (ConvertJob *)arg;
+  CellGrid *grid = job->grid;
+  uint64_t *sums = NULL;
+  // in grayscale mode the grid has no colors, the gray level of each cell
+  // only lives here until it is turned into an index
+  uint8_t *row_luma = NULL;
+  if (!job->sat) {
+    sums = malloc((size_t)grid->cols * 4 * sizeof(uint64_t));
+  }
+  if (!grid->colors) {
+    row_luma = malloc(grid->cols);
+  }
+  if ((!job->sat && !sums) || (!grid->colors && !row_luma)) {
+    printf("Error: Failed to allocate sampling buffers\n");
+    free(sums);
+    free(row_luma);
+    return NULL;
+  }
+  int out_channels = grid->colors ? 3 : 1;
+
+  // rows are claimed in order, so the oldest unconverted row always has a
+  // free slot once the readers catch up
+  int row;
+  while ((row = __atomic_fetch_add(&job->next_row, 1, __ATOMIC_RELAXED)) <
+         job->end_row) {
+    if (cell_grid_wait_slot(grid, row)) {
+      break;
+    }
+    int y0 = job->y_bounds[row];
+    int y1 = cell_span_end(job->y_bounds, row);
+    uint8_t *row_colors = grid->colors ? cell_grid_colors(grid, row) : row_luma;
+    if (job->sat) {
+      sat_sample_cell_row(job->sat, y0, y1, job->x_bounds, grid->cols,
+                          job->bg, row_colors);
+    } else {
+      job->sample_row(job->rgb_image, job->width, y0 - job->image_top,
+                      y1 - job->image_top, job->x_bounds, grid->cols, sums,
+                      job->bg, row_colors);
+    }
+    pixels_to_glyphs(row_colors, out_channels, grid->cols,
+                     cell_grid_indices(grid, row), NULL);
+    cell_grid_publish(grid, row);
+    __atomic_fetch_add(&job->done_rows, 1, __ATOMIC_RELAXED);
+  }
+  free(sums);
+  free(row_luma);
+  return NULL;
+}
+
+// build the text of whole rows into a buffer of write_size bytes and hand it
+// to the file in one write each time it fills up
+static int write_text_grid(FILE *asciifile, CellGrid *grid, int reader,
+                           size_t write_size, GtkProgressBar *progress_bar,
+                           int total_chars) {
+  int output_w = grid->cols, output_h = grid->rows;
+  size_t row_len = (size_t)output_w + 1;
+  if (write_size < row_len) {
+    write_size = row_len;
+  }
+  char *buffer = malloc(write_size);
+  if (!buffer) {
+    printf("Error: Failed to allocate text buffer\n");
+    return -1;
+  }
+  // the buffer already batches the writes, skip the stdio copy
+  setvbuf(asciifile, NULL, _IONBF, 0);
+
+  gint64 start_time = g_get_monotonic_time();
+  size_t used = 0, total = 0;
+  for (int row = 0; row < output_h; row++) {
+    if (cell_grid_wait_row(grid, row)) {
+      free(buffer);
+      return -1;
+    }
+    const uint8_t *row_indices = cell_grid_indices(grid, row);
+    for (int col = 0; col < output_w; col++) {
+      buffer[used + col] = gradient[row_indices[col]];
+    }
+    cell_grid_release(grid, reader, row);
+    buffer[used + output_w] = '\n';
+    used += row_len;
+
+    if (used + row_len > write_size || row == output_h - 1) {
+      if (fwrite(buffer, 1, used, asciifile) != used) {
+        perror("Error writing file");
+        free(buffer);
+        return -1;
+      }
+      total += used;
+      used = 0;
+      if (progress_bar) {
+        gtk_progress_bar_set_fraction(
+            progress_bar, (double)(row + 1) * output_w / total_chars);
+      }
+    }
+  }
+  free(buffer);
+
+  gint64 elapsed = g_get_monotonic_time() - start_time;
+  printf("Wrote %zu bytes of text in %.2f ms (%.1f MB/s)\n", total,
+         elapsed / 1000.0, (double)total / (elapsed ? elapsed : 1));
+  return 0;
+}
+
+int convert_to_grid(const uint8_t *rgb_image, const SummedAreaTable *sat,
+                    const ImagePyramid *pyramid, int width, int height,
+                    int channels, const RGB *bg_color, CellGrid *grid) {
+  int out_channels = grid->colors ? 3 : 1;
+  SampleRowFn sample_row = get_cell_row_sampler(channels, out_channels);
+  if (!sample_row) {
+    printf("Error: Unsupported number of channels: %d\n", channels);
+    cell_grid_abort(grid);
+    return -1;
+  }
+
+  // without a table start from the smallest reduced level that still has a
+  // pixel per cell, the walk below then costs about as much as the grid
+  const PyramidLevel *level =
+      sat ? NULL : pyramid_pick_level(pyramid, grid->cols, grid->rows);
+  if (level) {
+    rgb_image = level->pixels;
+    width = level->width;
+    height = level->height;
+  }
+
+  // every pixel of the image belongs to exactly one cell
+  int *x_bounds = malloc((grid->cols + 1) * sizeof(int));
+  int *y_bounds = malloc((grid->rows + 1) * sizeof(int));
+  if (!x_bounds || !y_bounds) {
+    printf("Error: Failed to allocate sampling buffers\n");
+    free(x_bounds);
+    free(y_bounds);
+    cell_grid_abort(grid);
+    return -1;
+  }
+  compute_cell_bounds(width, grid->cols, x_bounds);
+  compute_cell_bounds(height, grid->rows, y_bounds);
+  int64_t max_cell_area = (int64_t)max_cell_span(x_bounds, grid->cols) *
+                          max_cell_span(y_bounds, grid->rows);
+  // past this size the table sums wrap around, walk the pixels instead
+  if (max_cell_area >= SAT_MAX_CELL_AREA ||
+      (sat && sat->planes != out_channels)) {
+    sat = NULL;
+  }
+
+  ConvertJob job = {
+      .rgb_image = rgb_image,
+      .image_top = 0,
+      .sat = sat,
+      .sample_row = sample_row,
+      .width = width,
+      .bg = {bg_color->r, bg_color->g, bg_color->b},
+      .x_bounds = x_bounds,
+      .y_bounds = y_bounds,
+      .grid = grid,
+      .next_row = 0,
+      .end_row = grid->rows,
+      .done_rows = 0,
+  };
+  if (!grid->colors) {
+    job.bg[0] = rgb_to_gray(bg_color->r, bg_color->g, bg_color->b);
+  }
+  run_on_workers(get_worker_count(grid->rows), convert_row_worker, &job);
+
+  free(x_bounds);
+  free(y_bounds);
+  // a reader gave up or every worker bailed out before the grid was covered
+  if (job.done_rows < grid->rows) {
+    cell_grid_abort(grid);
+    return -1;
+  }
+  return 0;
+}
+
+int convert_stream_to_grid(const ImageLoad *image, size_t band_size,
+                           const RGB *bg_color, CellGrid *grid) {
+  int out_channels = grid->colors ? 3 : 1;
+  int width, height, channels;
+  JpegReader *reader =
+      jpeg_reader_open(image->file, image->min_w, image->min_h,
+                       image->grayscale, &width, &height, &channels);
+  SampleRowFn sample_row =
+      reader ? get_cell_row_sampler(channels, out_channels) : NULL;
+  if (!sample_row) {
+    printf("Error: Failed to decode image\n");
+    jpeg_reader_close(reader);
+    cell_grid_abort(grid);
+    return -1;
+  }
+
+  int *x_bounds = malloc((grid->cols + 1) * sizeof(int));
+  int *y_bounds = malloc((grid->rows + 1) * sizeof(int));
+  if (x_bounds && y_bounds) {
+    compute_cell_bounds(width, grid->cols, x_bounds);
+    compute_cell_bounds(height, grid->rows, y_bounds);
+  }
+  // the band holds whole cell rows, as many as fit in band_size but at
+  // least the tallest one
+  size_t row_bytes = (size_t)width * channels;
+  size_t band_rows = band_size / row_bytes;
+  if (y_bounds) {
+    size_t span = max_cell_span(y_bounds, grid->rows);
+    band_rows = band_rows > span ? band_rows : span;
+  }
+  band_rows = band_rows < (size_t)height ? band_rows : (size_t)height;
+  uint8_t *band = x_bounds && y_bounds ? malloc(band_rows * row_bytes) : NULL;
+  if (!band) {
+    printf("Error: Failed to allocate sampling buffers\n");
+    free(x_bounds);
+    free(y_bounds);
+    jpeg_reader_close(reader);
+    cell_grid_abort(grid);
+    return -1;
+  }
+
+  ConvertJob job = {
+      .rgb_image = band,
+      .sat = NULL,
+      .sample_row = sample_row,
+      .width = width,
+      .bg = {bg_color->r, bg_color->g, bg_color->b},
+      .x_bounds = x_bounds,
+      .y_bounds = y_bounds,
+      .grid = grid,
+      .done_rows = 0,
+  };
+  if (!grid->colors) {
+    job.bg[0] = rgb_to_gray(bg_color->r, bg_color->g, bg_color->b);
+  }
+
+  // source rows [job.image_top, decoded) are in the band
+  int decoded = 0;
+  int res = 0;
+  int row = 0;
+  while (row < grid->rows) {
+    int top = y_bounds[row];
+    int end = row + 1;
+    while (end < grid->rows &&
+           (size_t)(cell_span_end(y_bounds, end) - top) <= band_rows) {
+      end++;
+    }
+    int bottom = cell_span_end(y_bounds, end - 1);
+    // with more cells than pixels the next cell row may start on a row that
+    // is already decoded, keep it
+    if (decoded > top) {
+      memmove(band, band + (size_t)(top - job.image_top) * row_bytes,
+              (size_t)(decoded - top) * row_bytes);
+    }
+    job.image_top = top;
+    if (jpeg_reader_read(reader, band + (size_t)(decoded - top) * row_bytes,
+                         bottom - decoded)) {
+      res = -1;
+      break;
+    }
+    decoded = bottom;
+
+    job.next_row = row;
+    job.end_row = end;
+    run_on_workers(get_worker_count(end - row), convert_row_worker, &job);
+    // a reader gave up or every worker bailed out
+    if (job.done_rows < end) {
+      res = -1;
+      break;
+    }
+    row = end;
+  }
+
+  free(band);
+  free(x_bounds);
+  free(y_bounds);
+  jpeg_reader_close(reader);
+  if (res) {
+    cell_grid_abort(grid);
+  }
+  return res;
+}
+
 /**
- * @brief Converts an RGB image to ASCII art and saves to file
+ * @brief Saves a converted cell grid as ASCII art to file
  * @param output_filename Output file path
- * @param rgb_image Input image data
- * @param width Image width in pixels
- * @param height Image height in pixels
- * @param w_step Width sampling step
- * @param h_step Height sampling step
- * @param channels Number of color channels
- * @param output_w Output width in characters
- * @param output_h Output height in characters
- * @param ascii_colors Buffer to store color data
+ * @param grid Converted cells
+ * @param reader Index of this consumer of the grid rows
+ * @param write_size Size in bytes of each write of the text file
+ * @param progress_bar Progress bar to update, may be NULL
+ * @param total_chars Number of chars used to compute the progress
  * @return 0 on success, -1 on failure
  */
-int parse2file(char *output_filename, uint8_t *rgb_image, int width, int height,
-               int w_step, int h_step, int channels,
-               unsigned char *ascii_colors, GtkProgressBar *progress_bar,
-               int total_chars, GtkWindow *dialog) {
-
-  char gradient[] = {'@', '&', '%', '#', '*', '+',  '~', '=',
-                     '_', '-', ';', ':', '`', '\'', '.', ' '};
-  int num_chars = sizeof(gradient) / sizeof(gradient[0]);
-
+int parse2file(char *output_filename, CellGrid *grid, int reader,
+               size_t write_size, GtkProgressBar *progress_bar,
+               int total_chars) {
   FILE *asciifile = fopen(output_filename, "w");
   if (!asciifile) {
     perror("Error opening file");
+    cell_grid_abort(grid);
     return -1;
   }
 
-  int counter_z = 0;
-  for (int y = 0; y < height; y += h_step) {
-    for (int x = 0; x < width; x += w_step) {
-      size_t index = (y * width + x) * channels;
-      unsigned char r = 0;
-      unsigned char g = 0;
-      unsigned char b = 0;
+  int res = write_text_grid(asciifile, grid, reader, write_size, progress_bar,
+                            total_chars);
+  if (fclose(asciifile) && !res) {
+    perror("Error writing file");
+    res = -1;
+  }
+  if (res) {
+    cell_grid_abort(grid);
+  }
+  return res;
+}
 
-      if (rgb_image[index] && rgb_image[index + 1] && rgb_image[index + 2]) {
-        r = rgb_image[index];
-        g = rgb_image[index + 1];
-        b = rgb_image[index + 2];
-      }
+// the text file is only a side output, it is written while the PNG renders
+static void *write_text_on_background(void *arg) {
+  AppData *app_data = (AppData *)arg;
+  if (parse2file(app_data->output_text_filepath, app_data->grid, TEXT_READER,
+                 app_data->text_write_size, NULL, app_data->total_chars)) {
+    printf("Error writing ASCII text: %s\n", app_data->output_text_filepath);
+  } else {
+    printf("ASCII text written: %s\n", app_data->output_text_filepath);
+  }
+  return NULL;
+}
 
-      int intensity = (r + g + b) / 3;
-      int gradient_index = (intensity * (num_chars - 1)) / 255;
-      fprintf(asciifile, "%c", gradient[gradient_index]);
+// bytes of decoded rows a streamed conversion keeps, half of the budget, the
+// rest is left to the cell rows and the rendered image
+static size_t get_stream_band_size(AppData *app_data) {
+  return app_data->memory_budget / 2;
+}
 
-      ascii_colors[counter_z * 3] = r;
-      ascii_colors[counter_z * 3 + 1] = g;
-      ascii_colors[counter_z * 3 + 2] = b;
-      counter_z++;
-      gtk_progress_bar_set_fraction(progress_bar,
-                                    (float)(counter_z / total_chars));
-    }
-    fprintf(asciifile, "\n");
+static void *convert_on_background(void *arg) {
+  AppData *app_data = (AppData *)arg;
+  ImageLoad *image = app_data->image;
+  gint64 start_time = g_get_monotonic_time();
+  // the image may have been decoded smaller than its header says
+  int res = image->streamed
+                ? convert_stream_to_grid(image, get_stream_band_size(app_data),
+                                         app_data->bg_color, app_data->grid)
+                : convert_to_grid(image->pixels, image->sat, image->pyramid,
+                                  image->pixels_w, image->pixels_h,
+                                  image->channels, app_data->bg_color,
+                                  app_data->grid);
+  if (res) {
+    printf("Error during ASCII conversion\n");
+    return NULL;
   }
-  fclose(asciifile);
-  sleep(1);
-  return 0;
+  gint64 elapsed = g_get_monotonic_time() - start_time;
+  printf("ASCII conversion complete\n");
+  printf("Sampled %d x %d px in %.2f ms (%.1f Mpx/s, %s kernel)\n",
+         image->pixels_w, image->pixels_h, elapsed / 1000.0,
+         (double)image->pixels_w * image->pixels_h / (elapsed ? elapsed : 1),
+         glyph_kernel_name());
+  return NULL;
+}
+
+// bytes of the budget left for the rendered image once the input, its table
+// and the cell rows are in memory, 0 if there is no budget
+static size_t get_render_band_size(AppData *app_data) {
+  if (!app_data->memory_budget) {
+    return 0;
+  }
+  CellGrid *grid = app_data->grid;
+  ImageLoad *image = app_data->image;
+  size_t used =
+      (image->streamed
+           ? get_stream_band_size(app_data)
+           : (size_t)image->pixels_w * image->pixels_h * image->channels) +
+      (size_t)grid->slots * grid->cols * (grid->colors ? 4 : 1);
+  if (image->sat) {
+    used += sat_size(image->pixels_w, image->pixels_h,
+                     image->sat->planes + image->sat->alpha);
+  }
+  if (image->pyramid) {
+    used += pyramid_size(image->pyramid);
+  }
+  // the renderer still keeps at least one line of glyphs
+  return used < app_data->memory_budget ? app_data->memory_budget - used : 1;
 }
 
 /*
- * Start the parsing and rendering on a different thread
+ * Start the parsing and rendering on a different thread, the conversion,
+ * the text writer and the renderer run at the same time and hand rows to
+ * each other through the grid
  * */
 void *start_on_background(void *arg) {
   AppData *app_data = (AppData *)arg;
-  // if no issues happend while generating the text file, then finish
-  if (!parse2file(app_data->output_text_filepath, app_data->rgb_image,
-                  app_data->img_w, app_data->img_h,
-                  app_data->img_w / app_data->out_w,
-                  app_data->img_h / app_data->out_h, app_data->img_bpp,
-                  app_data->ascii_colors, app_data->loading_modal->progress_bar,
-                  app_data->total_chars, app_data->loading_modal->window)) {
-    printf("ASCII conversion complete: %s\n", app_data->output_text_filepath);
-    // if rndr_flag is enable, then open a ncurses menu to select a font_family
-    // on the gresources and a background color (black = 0 or white = 255)
-    update_loading_modal_to_rendering(app_data->loading_modal);
-    renderAsciiPNG(app_data->output_text_filepath, app_data->out_w,
-                   app_data->out_h, app_data->ascii_colors, app_data->bg_color,
-                   app_data->selected_font, app_data->loading_modal,
-                   app_data->total_chars);
+  ImageLoad *image = app_data->image; // referenced for this conversion
+  pthread_t t_convert, t_text;
+  // the decode started when the file was opened, it may still be running
+  if (image_load_wait(image)) {
+    printf("Error during ASCII conversion\n");
+    cell_grid_free(app_data->grid);
+    app_data->grid = NULL;
+    image_load_unref(image);
+    pthread_exit(NULL);
+  }
+  if (pthread_create(&t_convert, NULL, convert_on_background, app_data)) {
+    printf("Error during ASCII conversion\n");
+    cell_grid_free(app_data->grid);
+    app_data->grid = NULL;
+    image_load_unref(image);
+    pthread_exit(NULL);
+  }
+  bool text_started =
+      app_data->write_text_output &&
+      !pthread_create(&t_text, NULL, write_text_on_background, app_data);
+  if (app_data->write_text_output && !text_started) {
+    // nobody is going to release the text rows
+    cell_grid_release(app_data->grid, TEXT_READER, app_data->grid->rows);
+  }
+
+  update_loading_modal_to_rendering(app_data->loading_modal);
+  CellGrid *grid = app_data->grid;
+  float char_h = fit_glyph_height(grid->cols, grid->rows, grid->colors ? 3 : 1,
+                                  app_data->glyph_height,
+                                  app_data->max_render_pixels,
+                                  app_data->max_render_bytes);
+  int res = renderAsciiPNG(app_data->output_filepath, grid, RENDER_READER,
+                           app_data->bg_color, app_data->selected_font, char_h,
+                           app_data->loading_modal, app_data->total_chars,
+                           get_render_band_size(app_data));
+  if (res) {
+    cell_grid_abort(app_data->grid);
+  }
+  pthread_join(t_convert, NULL);
+  if (text_started) {
+    pthread_join(t_text, NULL);
+  }
+  if (!res) {
     update_loading_modal_to_finish(app_data->loading_modal,
                                    app_data->output_filepath);
-    printf("PNG rendering complete\n");
-    free(app_data->ascii_colors);
-    app_data->ascii_colors = NULL;
-  } else {
-    // if error then free all the memory and exit
-    printf("Error during ASCII conversion\n");
-    free(app_data->ascii_colors);
-    app_data->ascii_colors = NULL;
+    printf("PNG rendering complete (%s compositor)\n",
+           composite_kernel_name());
   }
+  cell_grid_free(app_data->grid);
+  app_data->grid = NULL;
+  image_load_unref(image);
   pthread_exit(NULL);
 }
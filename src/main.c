@@ -1,7 +1,6 @@
 #include "glib-object.h"
 #include "glib.h"
 #include "stb/stb_image.h"
-#include "stb/stb_image_write.h"
 #include "stb/stb_truetype.h"
 #include "types.h"
 #include <ascii_gtk.h>
@@ -9,11 +8,14 @@
 #include <getopt.h>
 #include <gio/gio.h>
 #include <gtk/gtk.h>
+#include <image_cache.h>
+#include <image_loader.h>
 #include <logic.h>
 #include <regex.h>
 #include <render.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 // Global application and window references
 AppData *app_data;
@@ -35,11 +37,68 @@ static const int min_percent_value = 1;
 static const int default_percent_value = 2;
 static const int max_percent_value = 3;
 static const float slider_step_size = 0.5;
+static const size_t default_text_write_size = 1 << 20;
+static const gint64 default_cache_budget_mib = 512;
 
 static const RGB default_background_color = {255, 255, 255};
 
+// set from the command line, in MiB
+static gint64 memory_budget_mib = 0;
+static gint64 cache_budget_mib = default_cache_budget_mib;
+// set from the command line, "-" reads the image from stdin
+static gchar *input_option = NULL;
+static gboolean grayscale_option = FALSE;
+static gboolean no_text_option = FALSE;
+// rendered char height in pixels, the PNG budgets shrink it when set
+static gint glyph_size_option = DEFAULT_GLYPH_HEIGHT;
+static gdouble max_megapixels = 0;
+static gint64 max_png_mib = 0;
+
+static const GOptionEntry option_entries[] = {
+    {"input", 'i', G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME, &input_option,
+     "Image to open, - reads it from stdin or a pipe", "FILE"},
+    {"grayscale", 'g', G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE,
+     &grayscale_option,
+     "Convert in grayscale and render a single channel PNG", NULL},
+    {"no-text", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, &no_text_option,
+     "Only render the PNG, skip the .txt file", NULL},
+    {"memory-budget", 'm', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT64,
+     &memory_budget_mib,
+     "Memory a conversion may use, the output is rendered in bands to fit. "
+     "JPEGs that don't fit are decoded in bands too, other formats are "
+     "still decoded whole",
+     "MIB"},
+    {"cache-budget", 'c', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT64,
+     &cache_budget_mib,
+     "Memory kept for the decoded images of recently opened files", "MIB"},
+    {"glyph-size", 's', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+     &glyph_size_option, "Height of a rendered char in pixels", "PX"},
+    {"max-pixels", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_DOUBLE,
+     &max_megapixels,
+     "Shrink the rendered chars until the PNG has at most this many "
+     "megapixels",
+     "MP"},
+    {"max-png-size", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT64, &max_png_mib,
+     "Shrink the rendered chars until the uncompressed PNG fits", "MIB"},
+    {NULL}};
+
 static void *on_activate(GtkApplication *app, gpointer user_data) {
   AppData *app_data = (AppData *)user_data;
+  app_data->memory_budget =
+      memory_budget_mib > 0 ? (size_t)memory_budget_mib << 20 : 0;
+  app_data->grayscale = grayscale_option;
+  app_data->write_text_output = !no_text_option;
+  app_data->glyph_height =
+      glyph_size_option >= MIN_GLYPH_HEIGHT ? glyph_size_option
+                                            : DEFAULT_GLYPH_HEIGHT;
+  app_data->max_render_pixels =
+      max_megapixels > 0 ? (int64_t)(max_megapixels * 1e6) : 0;
+  app_data->max_render_bytes =
+      max_png_mib > 0 ? (size_t)max_png_mib << 20 : 0;
+  if (!app_data->image_cache) {
+    app_data->image_cache = image_cache_new(
+        cache_budget_mib > 0 ? (size_t)cache_budget_mib << 20 : 0);
+  }
   GtkBuilder *builder = gtk_builder_new();
   gtk_builder_add_from_resource(
       builder, "/org/asciiparser/data/ui/ascii-parser.ui", NULL);
@@ -51,6 +110,9 @@ static void *on_activate(GtkApplication *app, gpointer user_data) {
   gtk_application_add_window(GTK_APPLICATION(app_data->app),
                              GTK_WINDOW(app_data->active_win));
   gtk_window_present(GTK_WINDOW(app_data->active_win));
+  if (input_option) {
+    lauch_processing_window(input_option);
+  }
   return 0;
 }
 
@@ -61,14 +123,21 @@ int load_file_metadata(char *filepath, AppData *app_data) {
   }
   app_data->input_filepath = g_strdup_printf("%s", filepath);
 
-  if (!stbi_info(app_data->input_filepath, &app_data->img_w, &app_data->img_h,
-                 &app_data->img_bpp)) {
-    printf("Error: Unsupported image format\n");
+  // the window opens as soon as the header is read, the pixels are decoded
+  // in the background while the user picks the output options. Files opened
+  // again are taken from the cache as long as they didn't change
+  ImageLoad *image = image_cache_open(
+      app_data->image_cache, app_data->input_filepath,
+      app_data->memory_budget, max_percent_value * 2 / 100.0,
+      max_percent_value / 100.0, app_data->grayscale);
+  if (!image) {
     return -1;
   }
-  // extract image data
-  app_data->rgb_image = stbi_load(app_data->input_filepath, &app_data->img_w,
-                                  &app_data->img_h, &app_data->img_bpp, 0);
+  image_load_unref(app_data->image);
+  app_data->image = image;
+  app_data->img_w = image->width;
+  app_data->img_h = image->height;
+  app_data->img_bpp = image->channels;
   return 0;
 }
 
@@ -84,6 +153,8 @@ void init_globals(AppData *app_data, char *filepath) {
   app_data->min_out_h = (int)(app_data->img_h * min_percent_value / 100);
   app_data->min_out_w = (int)(app_data->img_w * min_percent_value / 100);
 
+  app_data->text_write_size = default_text_write_size;
+
   app_data->bg_color = g_new0(RGB, 1);
   app_data->bg_color->r = default_background_color.r;
   app_data->bg_color->g = default_background_color.g;
@@ -91,8 +162,6 @@ void init_globals(AppData *app_data, char *filepath) {
 }
 
 void lauch_processing_window(char *filepath) {
-  stbi_flip_vertically_on_write(1);
-
   if (load_file_metadata(filepath, app_data)) {
     return;
   };
@@ -113,10 +182,13 @@ void lauch_processing_window(char *filepath) {
   // filename label
   GtkLabel *filepath_label =
       GTK_LABEL(gtk_builder_get_object(builder, "filepath_label"));
-  gtk_label_set_label(
-      filepath_label,
-      g_strdup_printf("Selected file: %s",
-                      g_file_get_basename(g_file_new_for_path(filepath))));
+  bool from_stdin = !strcmp(filepath, "-");
+  gtk_label_set_label(filepath_label,
+                      g_strdup_printf("Selected file: %s",
+                                      from_stdin ? "stdin"
+                                                 : g_file_get_basename(
+                                                       g_file_new_for_path(
+                                                           filepath))));
   // font drop down
   GtkDropDown *drop =
       GTK_DROP_DOWN(gtk_builder_get_object(builder, "font_drop_down"));
@@ -124,10 +196,12 @@ void lauch_processing_window(char *filepath) {
                           G_LIST_MODEL(gtk_string_list_new(font_options)));
   g_signal_connect(GTK_WIDGET(drop), "notify::selected",
                    G_CALLBACK(select_font_action), app_data);
-  // picture thumbnail
-  gtk_picture_set_file(
-      GTK_PICTURE(gtk_builder_get_object(builder, "selected_img")),
-      g_file_new_for_path(filepath));
+  // picture thumbnail, stdin can't be read a second time
+  if (!from_stdin) {
+    gtk_picture_set_file(
+        GTK_PICTURE(gtk_builder_get_object(builder, "selected_img")),
+        g_file_new_for_path(filepath));
+  }
   // manual sizing zone
   app_data->manual_sizing_box =
       GTK_BOX(gtk_builder_get_object(builder, "manual_sizing_box"));
@@ -201,10 +275,14 @@ int main(int argc, char **argv) {
 
   app_data->app = gtk_application_new("org.riprtx.asciiParser",
                                       G_APPLICATION_DEFAULT_FLAGS);
+  g_application_add_main_option_entries(G_APPLICATION(app_data->app),
+                                        option_entries);
   g_signal_connect(app_data->app, "activate", G_CALLBACK(on_activate),
                    app_data);
   int status = g_application_run(G_APPLICATION(app_data->app), argc, argv);
   g_object_unref(app_data->app);
+  image_load_unref(app_data->image);
+  image_cache_free(app_data->image_cache);
 
   return status;
 }
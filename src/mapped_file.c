@@ -0,0 +1,39 @@
+#include <mapped_file.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+MappedFile *mapped_file_open_fd(int fd) {
+  struct stat st;
+  if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+    printf("Error: Can't map an empty or non regular file\n");
+    return NULL;
+  }
+
+  void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    perror("Error mapping file");
+    return NULL;
+  }
+  // decoders walk the file once, let the kernel read ahead and drop the
+  // pages behind them
+  madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+  MappedFile *file = malloc(sizeof(MappedFile));
+  if (!file) {
+    munmap(data, st.st_size);
+    return NULL;
+  }
+  file->data = data;
+  file->size = st.st_size;
+  return file;
+}
+
+void mapped_file_close(MappedFile *file) {
+  if (!file) {
+    return;
+  }
+  munmap((void *)file->data, file->size);
+  free(file);
+}
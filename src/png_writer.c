@@ -0,0 +1,209 @@
+#include <png_writer.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PNG_IDAT_SIZE (1 << 16)
+#define PNG_COMPRESSION_LEVEL 6
+#define PNG_FILTER_COUNT 5
+
+static void put_u32(uint8_t *p, uint32_t v) {
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+static int write_chunk(FILE *file, const char *type, const uint8_t *data,
+                       uint32_t len) {
+  uint8_t head[8], tail[4];
+  put_u32(head, len);
+  memcpy(head + 4, type, 4);
+  uLong crc = crc32(0, head + 4, 4);
+  if (len) {
+    crc = crc32(crc, data, len);
+  }
+  put_u32(tail, (uint32_t)crc);
+  if (fwrite(head, 1, 8, file) != 8 ||
+      (len && fwrite(data, 1, len, file) != len) ||
+      fwrite(tail, 1, 4, file) != 4) {
+    perror("Error writing PNG");
+    return 1;
+  }
+  return 0;
+}
+
+static int flush_idat(PngWriter *writer) {
+  uint32_t len = (uint32_t)(writer->idat_size - writer->zs.avail_out);
+  if (!len) {
+    return 0;
+  }
+  writer->zs.next_out = writer->idat;
+  writer->zs.avail_out = writer->idat_size;
+  return write_chunk(writer->file, "IDAT", writer->idat, len);
+}
+
+static void free_writer(PngWriter *writer) {
+  free(writer->prev_row);
+  free(writer->filtered);
+  free(writer->idat);
+  free(writer);
+}
+
+PngWriter *png_writer_open(const char *filename, int width, int height,
+                           int channels) {
+  static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a,
+                                       '\n'};
+  if (width <= 0 || height <= 0 || (channels != 1 && channels != 3)) {
+    printf("Error: Invalid PNG size %dx%d with %d channels\n", width, height,
+           channels);
+    return NULL;
+  }
+
+  PngWriter *writer = calloc(1, sizeof(PngWriter));
+  if (!writer) {
+    return NULL;
+  }
+  writer->width = width;
+  writer->height = height;
+  writer->channels = channels;
+  writer->row_bytes = (size_t)width * channels;
+  writer->idat_size = PNG_IDAT_SIZE;
+  writer->prev_row = calloc(writer->row_bytes, 1);
+  writer->filtered = malloc((writer->row_bytes + 1) * PNG_FILTER_COUNT);
+  writer->idat = malloc(writer->idat_size);
+  if (!writer->prev_row || !writer->filtered || !writer->idat) {
+    printf("Error: Failed to allocate PNG buffers\n");
+    free_writer(writer);
+    return NULL;
+  }
+  if (deflateInit(&writer->zs, PNG_COMPRESSION_LEVEL) != Z_OK) {
+    printf("Error: Failed to init PNG compression\n");
+    free_writer(writer);
+    return NULL;
+  }
+  writer->zs.next_out = writer->idat;
+  writer->zs.avail_out = writer->idat_size;
+
+  writer->file = fopen(filename, "wb");
+  if (!writer->file) {
+    perror("Error opening PNG file");
+    deflateEnd(&writer->zs);
+    free_writer(writer);
+    return NULL;
+  }
+
+  uint8_t ihdr[13];
+  put_u32(ihdr, width);
+  put_u32(ihdr + 4, height);
+  ihdr[8] = 8;                        // bits per channel
+  ihdr[9] = channels == 1 ? 0 : 2;    // gray or RGB
+  ihdr[10] = ihdr[11] = ihdr[12] = 0; // deflate, filters, no interlace
+  if (fwrite(signature, 1, 8, writer->file) != 8 ||
+      write_chunk(writer->file, "IHDR", ihdr, 13)) {
+    png_writer_close(writer);
+    return NULL;
+  }
+  return writer;
+}
+
+static uint8_t paeth(int a, int b, int c) {
+  int p = a + b - c;
+  int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+  if (pa <= pb && pa <= pc) {
+    return a;
+  }
+  return pb <= pc ? b : c;
+}
+
+// filter the row with every PNG filter and keep the one with the smallest sum
+// of absolute values, the same heuristic libpng and stb use
+static const uint8_t *filter_row(PngWriter *writer, const uint8_t *row) {
+  size_t n = writer->row_bytes;
+  int bpp = writer->channels;
+  const uint8_t *up = writer->prev_row;
+  const uint8_t *best = NULL;
+  uint64_t best_cost = UINT64_MAX;
+
+  for (int type = 0; type < PNG_FILTER_COUNT; type++) {
+    uint8_t *out = writer->filtered + (n + 1) * type;
+    out[0] = type;
+    uint64_t cost = 0;
+    for (size_t i = 0; i < n; i++) {
+      int a = i >= (size_t)bpp ? row[i - bpp] : 0;
+      int b = up[i];
+      int c = i >= (size_t)bpp ? up[i - bpp] : 0;
+      uint8_t v;
+      switch (type) {
+      case 0:
+        v = row[i];
+        break;
+      case 1:
+        v = row[i] - a;
+        break;
+      case 2:
+        v = row[i] - b;
+        break;
+      case 3:
+        v = row[i] - ((a + b) >> 1);
+        break;
+      default:
+        v = row[i] - paeth(a, b, c);
+        break;
+      }
+      out[i + 1] = v;
+      cost += abs((int8_t)v);
+    }
+    if (cost < best_cost) {
+      best_cost = cost;
+      best = out;
+    }
+  }
+  return best;
+}
+
+int png_writer_write_rows(PngWriter *writer, const uint8_t *rows,
+                          size_t stride, int count) {
+  for (int r = 0; r < count; r++) {
+    if (writer->rows_written >= writer->height) {
+      printf("Error: Too many rows written to PNG\n");
+      return 1;
+    }
+    const uint8_t *row = rows + stride * r;
+    writer->zs.next_in = (Bytef *)filter_row(writer, row);
+    writer->zs.avail_in = writer->row_bytes + 1;
+    while (writer->zs.avail_in) {
+      if (deflate(&writer->zs, Z_NO_FLUSH) == Z_STREAM_ERROR) {
+        printf("Error: Failed to compress PNG row\n");
+        return 1;
+      }
+      if (!writer->zs.avail_out && flush_idat(writer)) {
+        return 1;
+      }
+    }
+    memcpy(writer->prev_row, row, writer->row_bytes);
+    writer->rows_written++;
+  }
+  return 0;
+}
+
+int png_writer_close(PngWriter *writer) {
+  int res = writer->rows_written == writer->height ? 0 : 1;
+  while (!res) {
+    int status = deflate(&writer->zs, Z_FINISH);
+    if (status == Z_STREAM_ERROR || flush_idat(writer)) {
+      res = 1;
+    } else if (status == Z_STREAM_END) {
+      break;
+    }
+  }
+  if (!res) {
+    res = write_chunk(writer->file, "IEND", NULL, 0);
+  }
+  deflateEnd(&writer->zs);
+  if (fclose(writer->file) && !res) {
+    perror("Error writing PNG");
+    res = 1;
+  }
+  free_writer(writer);
+  return res;
+}
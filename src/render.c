@@ -1,8 +1,17 @@
+#include "cell_grid.h"
+#include "font_registry.h"
+#include "glyph_atlas.h"
+#include "glyph_kernel.h"
 #include "gtk/gtk.h"
+#include "png_writer.h"
+#include "span_compositor.h"
 #include "types.h"
+#include "utils.h"
 #include <gio/gio.h>
 #include <glib.h>
 #include <gmodule.h>
+#include <inttypes.h>
+#include <math.h>
 #include <ncurses.h>
 #include <render.h>
 #include <stdint.h>
@@ -12,260 +21,356 @@
 
 #define STB_TRUETYPE_IMPLEMENTATION
 #include "stb/stb_truetype.h"
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "stb/stb_image_write.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb/stb_image.h"
 
 #define NUM_FONTS 8
 #define NUM_COLORS 3
 
-/**
- * @brief Renders ASCII art to a PNG image
- * @param output_filename Base output filename
- * @param rgb_image Original image data
- * @param w Image width
- * @param h Image height
- * @param w_step Width step
- * @param h_step Height step
- * @param channels Color channels
- * @param output_w Output width in chars
- * @param output_h Output height in chars
- * @param ascii_colors Color data for ASCII chars
- * @return 0 on success, 1 on failure
- */
-int renderAsciiPNG(char *output_filename, int output_w, int output_h,
-                   unsigned char *ascii_colors, RGB *bg_color, char *font_name,
-                   LoadingModal *loading_modal, int total_chars) {
-  // creare the img data
-  float char_h = 32.0f;
-  float char_w = char_h / 2;
-  int width = output_w * char_w;
-  int height = output_h * char_h;
-
-  char font_file[] = "/org/asciiparser/data/fonts/";
-  strcat(font_file, font_name);
-
-  unsigned char *pixels = malloc(width * height * 3);
-  if (!pixels) {
-    printf("Error: Failed to allocate pixel buffer\n");
-    pixels = NULL;
-    return 1;
+// for render the image I decided to use a different scale of chars, index i
+// of the conversion gradient is drawn with render_gradient[i], for more info
+// please check the README.md file
+static const char render_gradient[] = "$&8WMB@%#*+=-:.' ";
+
+// paint `count` pixels of `channels` bytes with the background color
+static void fill_background(uint8_t *pixels, size_t count, const uint8_t *bg,
+                            int channels) {
+  if (channels == 1) {
+    memset(pixels, bg[0], count);
+    return;
   }
-  memset(pixels, 0, width * height * 3);
-  for (int i = 0; i < width * height * 3; i += 3) {
-    pixels[i] = bg_color->r;
-    pixels[i + 1] = bg_color->g;
-    pixels[i + 2] = bg_color->b;
+  for (size_t i = 0; i < count; i++) {
+    pixels[i * 3] = bg[0];
+    pixels[i * 3 + 1] = bg[1];
+    pixels[i * 3 + 2] = bg[2];
   }
+}
 
-  // load font file
-  unsigned char *font_buffer = NULL;
-  stbtt_fontinfo font;
-
-  if (load_font(font_file, &font_buffer, &font)) {
-    free(pixels);
-    pixels = NULL;
-    printf("error loading font\n");
-    return EXIT_FAILURE;
+// encode the next `count` rows of the image and slide the band down by as
+// much, rows past the bottom of the band are only background
+static int flush_band(PngWriter *png, uint8_t *band, size_t row_bytes,
+                      int64_t band_h, int64_t count, const uint8_t *bg,
+                      int channels) {
+  while (count > 0) {
+    int64_t n = count < band_h ? count : band_h;
+    if (png_writer_write_rows(png, band, row_bytes, n)) {
+      return 1;
+    }
+    memmove(band, band + n * row_bytes, (band_h - n) * row_bytes);
+    fill_background(band + (band_h - n) * row_bytes, n * row_bytes / channels,
+                    bg, channels);
+    count -= n;
   }
+  return 0;
+}
 
-  // read ASCII content from the output text file
-  char *fcontent = NULL;
-  int res = get_text_from_file(output_filename, &fcontent);
-  if (res) {
-    // free up memory and set NULL the pointers
-    // as good programming practices
-    free(font_buffer);
-    free(pixels);
-    font_buffer = NULL;
-    pixels = NULL;
-    return EXIT_FAILURE;
-  }
+// pixel rows handed to a render worker at a time
+#define RENDER_STRIP_ROWS 16
 
-  // render text
-  const char *text = fcontent;
-  float scale = stbtt_ScaleForPixelHeight(&font, char_h); // set the font size
+// a batch of cell rows drawn into the band, split in strips of pixel rows
+// that workers claim until next_strip runs past y1
+typedef struct {
+  const GlyphAtlas *atlas;
+  const CellGrid *grid;
+  int cell_w, line_h; // fixed cell advance and line height in pixels
+  int baseline;       // baseline of the first cell row
+  int glyph_top, glyph_bottom; // rows any glyph reaches around its baseline
+  int64_t width;
+  int channels;
+  uint8_t fg_gray; // glyph color of grids without colors
+  uint8_t *band;
+  int64_t band_top;     // image row stored at the top of the band
+  int first_row, end_row; // cell rows of the batch
+  int64_t y0, y1;         // image rows of the band the batch can reach
+  int next_strip;
+} RenderJob;
+
+static inline int64_t cell_baseline(const RenderJob *job, int row) {
+  return job->baseline + (int64_t)row * job->line_h;
+}
 
-  // variables to locate the x,y position of each char in the image
-  int x = 0, y = 0;
-  // metrics of the font
-  int ascent, descent, line_gap;
-  stbtt_GetFontVMetrics(&font, &ascent, &descent, &line_gap);
-  y += (int)(ascent * scale);
-
-  // for every char, draw it inside the image in the x,y position and then add
-  // enought space to the next char
-  int counter = 0;
-  for (const char *c = text; *c; c++) {
-    if (*c == '\n') {
-      x = 0;
-      y += (int)((ascent - descent + line_gap) * scale);
-      continue;
-    }
+// blend the part of a glyph that falls in image rows [s0, s1)
+static void draw_glyph(const RenderJob *job, const AtlasGlyph *glyph,
+                       const uint8_t *color, int64_t left, int64_t top,
+                       int64_t s0, int64_t s1) {
+  const GlyphAtlas *atlas = job->atlas;
+  int channels = job->channels;
+  int dx0 = left < 0 ? (int)-left : 0;
+  int dx1 = left + glyph->w > job->width ? (int)(job->width - left) : glyph->w;
+  int dy0 = top < s0 ? (int)(s0 - top) : 0;
+  int dy1 = top + glyph->h > s1 ? (int)(s1 - top) : glyph->h;
+  if (dx0 >= dx1 || dy0 >= dy1) {
+    return;
+  }
 
-    int advance, lsb, x0, y0, x1, y1;
-    char render_char = switch_to_render_char(*c);
-
-    stbtt_GetCodepointHMetrics(&font, render_char, &advance, &lsb);
-    stbtt_GetCodepointBitmapBox(&font, render_char, scale, scale, &x0, &y0, &x1,
-                                &y1);
-
-    unsigned char *bitmap = malloc((x1 - x0) * (y1 - y0));
-    if (!bitmap) {
-      printf("Error: Failed to allocate bitmap\n");
-      free(fcontent);
-      free(font_buffer);
-      free(pixels);
-      pixels = NULL;
-      font_buffer = NULL;
-      fcontent = NULL;
-      return 1;
-    }
+  // the coverage blends the color over what is already there so the edges
+  // stay antialiased
+  uint8_t pattern[COMPOSITE_PATTERN_SIZE];
+  composite_pattern_init(pattern, color, channels);
+  size_t atlas_row = (size_t)atlas->width * channels;
+  for (int dy = dy0; dy < dy1; dy++) {
+    const uint8_t *coverage = atlas->pixels + (glyph->y + dy) * atlas_row +
+                              (size_t)(glyph->x + dx0) * channels;
+    uint8_t *dst = job->band + ((size_t)(top + dy - job->band_top) *
+                                    job->width +
+                                left + dx0) *
+                                   channels;
+    composite_span(dst, coverage, pattern, (dx1 - dx0) * channels);
+  }
+}
 
-    stbtt_MakeCodepointBitmap(&font, bitmap, x1 - x0, y1 - y0, x1 - x0, scale,
-                              scale, render_char);
-
-    // draw character with ascii colors
-    for (int dy = 0; dy < y1 - y0; dy++) {
-      for (int dx = 0; dx < x1 - x0; dx++) {
-        int pixel_y = (y + y0 + dy);
-        int pixel_x = x + x0 + dx;
-
-        if (pixel_y >= 0 && pixel_y < height && pixel_x >= 0 &&
-            pixel_x < width) {
-          int pos_pixel =
-              ((height - 1 - (y + y0 + dy)) * width + (x + x0 + dx)) * 3;
-          if (bitmap[dy * (x1 - x0) + dx] == 255 &&
-              counter < output_w * output_h) {
-            pixels[pos_pixel] = ascii_colors[counter * 3];
-            pixels[pos_pixel + 1] = ascii_colors[counter * 3 + 1];
-            pixels[pos_pixel + 2] = ascii_colors[counter * 3 + 2];
-          } else if (bitmap[dy * (x1 - x0) + dx] == 0 &&
-                     counter < output_w * output_h) {
-            pixels[pos_pixel] = bg_color->r;
-            pixels[pos_pixel + 1] = bg_color->g;
-            pixels[pos_pixel + 2] = bg_color->b;
-          }
-        }
+static void *render_strips_worker(void *arg) {
+  RenderJob *job = (RenderJob *)arg;
+  const CellGrid *grid = job->grid;
+  for (;;) {
+    int strip = __atomic_fetch_add(&job->next_strip, 1, __ATOMIC_RELAXED);
+    int64_t s0 = job->y0 + (int64_t)strip * RENDER_STRIP_ROWS;
+    if (s0 >= job->y1) {
+      break;
+    }
+    int64_t s1 = s0 + RENDER_STRIP_ROWS < job->y1 ? s0 + RENDER_STRIP_ROWS
+                                                   : job->y1;
+    for (int row = job->first_row; row < job->end_row; row++) {
+      int64_t baseline = cell_baseline(job, row);
+      if (baseline + job->glyph_bottom <= s0 ||
+          baseline + job->glyph_top >= s1) {
+        continue;
+      }
+      const uint8_t *row_indices = cell_grid_indices(grid, row);
+      const uint8_t *row_colors = cell_grid_colors(grid, row);
+      for (int col = 0; col < grid->cols; col++) {
+        const AtlasGlyph *glyph = &job->atlas->glyphs[row_indices[col]];
+        const uint8_t *color =
+            row_colors ? row_colors + col * 3 : &job->fg_gray;
+        draw_glyph(job, glyph, color, (int64_t)col * job->cell_w + glyph->xoff,
+                   baseline + glyph->yoff, s0, s1);
       }
     }
-    free(bitmap); // clean up the bitmap data
-    x += (int)(advance * scale);
-    gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(loading_modal->progress_bar),
-                                  (float)(counter / total_chars));
-    counter++;
   }
+  return NULL;
+}
 
-  // save to png
-  char png_filename[256];
-  snprintf(png_filename, sizeof(png_filename), "%s.png", output_filename);
-  if (!stbi_write_png(png_filename, width, height, 3, pixels, width * 3)) {
-    printf("Error saving PNG image\n");
+float fit_glyph_height(int cols, int rows, int channels, float char_h,
+                       int64_t max_pixels, size_t max_bytes) {
+  double limit = max_pixels > 0 ? (double)max_pixels : INFINITY;
+  if (max_bytes) {
+    limit = fmin(limit, (double)max_bytes / channels);
   }
-
-  // Cleanup
-  free(fcontent);
-  free(font_buffer);
-  free(pixels);
-  pixels = NULL;
-  font_buffer = NULL;
-  fcontent = NULL;
-
-  printf("Image rendered: %s\n", png_filename);
-  return 0;
+  // a cell is char_h / 2 x char_h pixels, whole pixel heights keep the
+  // glyphs as sharp as the requested size
+  double fit = floor(sqrt(2 * limit / ((double)cols * rows)));
+  if (fit >= char_h) {
+    return char_h;
+  }
+  if (fit < MIN_GLYPH_HEIGHT) {
+    printf("Warning: %d x %d chars don't fit the render budget, drawn at "
+           "%d px\n",
+           cols, rows, MIN_GLYPH_HEIGHT);
+    return MIN_GLYPH_HEIGHT;
+  }
+  printf("Glyphs shrunk from %.0f to %.0f px to fit the render budget\n",
+         char_h, fit);
+  return (float)fit;
 }
 
-// load a font from gresources by its filepath and save it in the font_buffer
-// variable
-int load_font(const char *font_resource_path, unsigned char **font_buffer,
-              stbtt_fontinfo *font) {
-  // check if the font exists embembed in gresources
-  GBytes *font_data = g_resources_lookup_data(
-      font_resource_path, G_RESOURCE_LOOKUP_FLAGS_NONE, NULL);
-  if (!font_data) {
-    printf("Error: Failed to load font resource at path '%s'\n",
-           font_resource_path);
+/**
+ * @brief Renders ASCII art to a PNG image
+ * @param output_filename PNG output filename
+ * @param grid Converted cells, rows are drawn as soon as they are published
+ * @param reader Index of the renderer as a consumer of the grid rows
+ * @param bg_color Color data for background image
+ * @param font_name Font filename for rendering
+ * @param char_h Height of a cell in pixels, cells are half as wide
+ * @param band_size Bytes of output pixels to keep in memory, 0 for the whole
+ *        image
+ * @return 0 on success, 1 on failure
+ */
+int renderAsciiPNG(char *output_filename, CellGrid *grid, int reader,
+                   RGB *bg_color, char *font_name, float char_h,
+                   LoadingModal *loading_modal, int total_chars,
+                   size_t band_size) {
+  // creare the img data
+  float char_w = char_h / 2;
+  int64_t width = (int64_t)(grid->cols * char_w);
+  int64_t height = (int64_t)(grid->rows * char_h);
+
+  // grids without colors are rendered as a 1 channel PNG, the glyphs are
+  // black or white, whichever stands out against the gray background
+  int channels = grid->colors ? 3 : 1;
+  uint8_t bg[3] = {bg_color->r, bg_color->g, bg_color->b};
+  uint8_t fg_gray = 0;
+  if (channels == 1) {
+    bg[0] = rgb_to_gray(bg_color->r, bg_color->g, bg_color->b);
+    fg_gray = bg[0] < 128 ? 255 : 0;
+  }
+
+  // PNG dimensions are 31 bit, the image itself may be well above 2 GB
+  size_t image_size;
+  if (width > INT32_MAX || height > INT32_MAX ||
+      checked_size_mul3(width, height, channels, &image_size)) {
+    printf("Error: Render size %" PRId64 "x%" PRId64 " is too large\n", width,
+           height);
     return 1;
   }
 
-  // get the font data from gresources
-  gsize font_size = 0;
-  *font_buffer = (unsigned char *)g_bytes_get_data(font_data, &font_size);
+  // fonts are loaded once per process and shared by every render
+  const stbtt_fontinfo *font = font_registry_get(font_name);
+  if (!font) {
+    printf("error loading font\n");
+    return EXIT_FAILURE;
+  }
 
-  // copy the font data to free up the GBytes data
-  *font_buffer = malloc(font_size);
-  if (!*font_buffer) {
-    printf("Error: Failed to allocate font buffer\n");
-    g_bytes_unref(font_data);
+  // only the chars of the gradient are ever drawn, each one is rasterized
+  // once for the whole render and every cell copies it from the atlas
+  int codepoints[GRADIENT_SIZE];
+  for (int i = 0; i < GRADIENT_SIZE; i++) {
+    codepoints[i] = render_gradient[i];
+  }
+  GlyphAtlas *atlas = glyph_atlas_new(font, char_h, codepoints,
+                                      GRADIENT_SIZE, channels);
+  if (!atlas) {
     return 1;
   }
-  memcpy(*font_buffer, g_bytes_get_data(font_data, NULL), font_size);
+  float scale = atlas->scale;
 
-  // free up GBytes
-  g_bytes_unref(font_data);
+  // metrics of the font, the first baseline sits one ascent below the top
+  int ascent, descent, line_gap;
+  stbtt_GetFontVMetrics(font, &ascent, &descent, &line_gap);
+  int y = (int)(ascent * scale);
+
+  // rows of pixels any glyph can reach above and below its baseline
+  int glyph_top = 0, glyph_bottom = 0;
+  for (int i = 0; i < GRADIENT_SIZE; i++) {
+    const AtlasGlyph *glyph = &atlas->glyphs[i];
+    glyph_top = glyph->yoff < glyph_top ? glyph->yoff : glyph_top;
+    glyph_bottom = glyph->yoff + glyph->h > glyph_bottom
+                       ? glyph->yoff + glyph->h
+                       : glyph_bottom;
+  }
 
-  // init  the font with stb
-  if (!stbtt_InitFont(font, *font_buffer, 0)) {
-    printf("Error: Failed to initialize font\n");
-    free(*font_buffer);
-    *font_buffer = NULL;
+  // the image is drawn into a band of rows that slides down with the cell
+  // rows, a row of pixels is encoded once no later glyph can reach it. The
+  // band always fits a whole line of glyphs
+  size_t row_bytes = width * channels;
+  int64_t band_h = band_size ? (int64_t)(band_size / row_bytes) : height;
+  int64_t min_band_h = glyph_bottom - glyph_top;
+  band_h = band_h < min_band_h ? min_band_h : band_h;
+  band_h = band_h > height ? height : band_h;
+  band_h = band_h > 0 ? band_h : 1;
+  unsigned char *pixels = malloc(band_h * row_bytes);
+  if (!pixels) {
+    printf("Error: Failed to allocate pixel buffer\n");
+    glyph_atlas_free(atlas);
     return 1;
   }
+  fill_background(pixels, band_h * width, bg, channels);
+  int64_t band_top = 0; // image row stored at the top of the band
 
-  return 0;
-}
+  PngWriter *png = png_writer_open(output_filename, width, height, channels);
+  if (!png) {
+    printf("Error saving PNG image\n");
+    free(pixels);
+    glyph_atlas_free(atlas);
+    return 1;
+  }
 
-// for render the image I decided to use a different scale of chars, so this
-// function executes the switch between the gradient of the text file and the
-// image gradient, for more info please check the README.md file
-static char switch_to_render_char(const char c) {
-  static const char render_gradient[] = "$&8WMB@%#*+=-:.' "; // Cadena contigua
-  static const char char_map[256] = {
-      // Tabla de búsqueda estática
-      ['@'] = 0,  ['&'] = 1,   ['%'] = 2,  ['#'] = 3, ['*'] = 4,  ['+'] = 5,
-      ['~'] = 6,  ['='] = 7,   ['_'] = 8,  ['-'] = 9, [';'] = 10, [':'] = 11,
-      ['`'] = 12, ['\''] = 13, ['.'] = 14, [' '] = 15};
-
-  const unsigned char index = char_map[(unsigned char)c];
-  if (index < sizeof(render_gradient)) {
-    return render_gradient[index];
+  // the fonts are monospace, so every cell has the same size and the origin
+  // of a cell only depends on its row and column
+  int cell_w = 0;
+  for (int i = 0; i < GRADIENT_SIZE; i++) {
+    cell_w = atlas->glyphs[i].advance > cell_w ? atlas->glyphs[i].advance
+                                               : cell_w;
   }
-  fprintf(stderr, "Carácter no mapeado: %c\n", c);
-  return ' '; // Carácter por defecto
-}
+  RenderJob job = {
+      .atlas = atlas,
+      .grid = grid,
+      .cell_w = cell_w,
+      .line_h = (int)((ascent - descent + line_gap) * scale),
+      .baseline = y,
+      .glyph_top = glyph_top,
+      .glyph_bottom = glyph_bottom,
+      .width = width,
+      .channels = channels,
+      .fg_gray = fg_gray,
+      .band = pixels,
+  };
 
-// extract all the text from a given filename
-static int get_text_from_file(char *filename, char **full_content) {
-  long fsize = 0;
-  FILE *fp = fopen(filename, "r");
-  if (fp) {
-    fseek(fp, 0, SEEK_END);
-    fsize = ftell(fp);
-    rewind(fp);
-
-    *full_content = (char *)malloc(fsize + 1);
-    if (!*full_content) {
-      printf("Error: Failed to allocate content buffer\n");
-      fclose(fp);
-      return 1;
+  // cell rows are drawn in batches, as many as fit in the band and in the
+  // grid slots. The pixel rows of a batch are split in strips drawn in
+  // parallel, each strip draws the glyphs in the same order as a single
+  // thread would so the output doesn't depend on the number of workers
+  int row = 0;
+  while (row < grid->rows) {
+    // every row above this line of glyphs is final
+    int64_t row_y = cell_baseline(&job, row);
+    if (row_y + glyph_bottom > band_top + band_h) {
+      int64_t done = row_y + glyph_top < height ? row_y + glyph_top : height;
+      if (flush_band(png, pixels, row_bytes, band_h, done - band_top, bg,
+                     channels)) {
+        printf("Error saving PNG image\n");
+        png_writer_close(png);
+        free(pixels);
+        glyph_atlas_free(atlas);
+        return 1;
+      }
+      band_top = done > band_top ? done : band_top;
     }
+    int64_t band_end = band_top + band_h < height ? band_top + band_h : height;
 
-    if (fread(*full_content, 1, fsize, fp) != fsize) {
-      printf("Error: Failed to read content file\n");
-      fclose(fp);
-      free(*full_content);
-      *full_content = NULL;
-      return 1;
+    int end = row + 1;
+    while (end < grid->rows && end - row < grid->slots &&
+           cell_baseline(&job, end) + glyph_bottom <= band_top + band_h) {
+      end++;
+    }
+    for (int r = row; r < end; r++) {
+      if (cell_grid_wait_row(grid, r)) {
+        printf("Error: Conversion stopped before row %d\n", r);
+        png_writer_close(png);
+        free(pixels);
+        glyph_atlas_free(atlas);
+        return 1;
+      }
+    }
+
+    job.first_row = row;
+    job.end_row = end;
+    job.band_top = band_top;
+    job.y0 = row_y + glyph_top > band_top ? row_y + glyph_top : band_top;
+    job.y1 = cell_baseline(&job, end - 1) + glyph_bottom;
+    job.y1 = job.y1 < band_end ? job.y1 : band_end;
+    job.next_strip = 0;
+    int64_t strips = job.y1 > job.y0 ? (job.y1 - job.y0 + RENDER_STRIP_ROWS -
+                                        1) / RENDER_STRIP_ROWS
+                                     : 0;
+    if (strips > 0) {
+      run_on_workers(get_worker_count((int)strips), render_strips_worker,
+                     &job);
+    }
+
+    for (int r = row; r < end; r++) {
+      cell_grid_release(grid, reader, r);
     }
-    printf("%ld \n", fsize);
-    (*full_content)[fsize] = '\0';
-    fclose(fp);
-    return 0;
-  } else {
-    printf("Error: Failed to open text file\n");
+    row = end;
+    gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(loading_modal->progress_bar),
+                                  (double)row * grid->cols / total_chars);
+  }
+
+  // save what is left, rows below the last glyphs are only background
+  int res = flush_band(png, pixels, row_bytes, band_h, height - band_top, bg,
+                       channels);
+  res = png_writer_close(png) || res;
+
+  // Cleanup
+  free(pixels);
+  glyph_atlas_free(atlas);
+  pixels = NULL;
+
+  if (res) {
+    printf("Error saving PNG image\n");
     return 1;
   }
+  printf("Image rendered: %s\n", output_filename);
+  return 0;
 }
 
 // type for menu option of ncurses
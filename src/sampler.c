@@ -0,0 +1,536 @@
+#include <sampler.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// split src_len pixels into cells spans as even as possible
+void compute_cell_bounds(int src_len, int cells, int *bounds) {
+  for (int i = 0; i <= cells; i++) {
+    bounds[i] = (int)((int64_t)i * src_len / cells);
+  }
+}
+
+int max_cell_span(const int *bounds, int cells) {
+  int span = 0;
+  for (int i = 0; i < cells; i++) {
+    int len = cell_span_end(bounds, i) - bounds[i];
+    if (len > span) {
+      span = len;
+    }
+  }
+  return span;
+}
+
+// c * a / 255 rounded to the nearest, exact for every 8 bit c and a
+static inline uint32_t premultiply(uint32_t c, uint32_t a) {
+  uint32_t t = c * a + 128;
+  return (t + (t >> 8)) >> 8;
+}
+
+// read the color of the pixel at p into r, g, b and a for each channel
+// layout, gray images repeat the value. Colors with alpha come out
+// premultiplied so they can be summed and composited on the background once
+// per cell
+#define LOAD_PIXEL_1(p, r, g, b, a)                                            \
+  do {                                                                         \
+    r = g = b = (p)[0];                                                        \
+    a = 255;                                                                   \
+  } while (0)
+#define LOAD_PIXEL_2(p, r, g, b, a)                                            \
+  do {                                                                         \
+    a = (p)[1];                                                                \
+    r = g = b = premultiply((p)[0], a);                                        \
+  } while (0)
+#define LOAD_PIXEL_3(p, r, g, b, a)                                            \
+  do {                                                                         \
+    r = (p)[0];                                                                \
+    g = (p)[1];                                                                \
+    b = (p)[2];                                                                \
+    a = 255;                                                                   \
+  } while (0)
+#define LOAD_PIXEL_4(p, r, g, b, a)                                            \
+  do {                                                                         \
+    a = (p)[3];                                                                \
+    r = premultiply((p)[0], a);                                                \
+    g = premultiply((p)[1], a);                                                \
+    b = premultiply((p)[2], a);                                                \
+  } while (0)
+
+// over operator on a cell: the premultiplied sum plus the background where
+// the cell is not covered, averaged over the area. Opaque cells have
+// sum_a == 255 * area and get the plain average
+static inline uint8_t composite_cell(uint64_t sum_c, uint64_t sum_a,
+                                     uint64_t area, uint8_t bg) {
+  return (255 * sum_c + bg * (255 * area - sum_a)) / (255 * area);
+}
+
+// sums holds r, g, b and alpha per cell
+static void average_cells(const uint64_t *sums, int rows, const int *x_bounds,
+                          int cols, const uint8_t *bg, uint8_t *row_colors) {
+  for (int c = 0; c < cols; c++) {
+    uint64_t area =
+        (uint64_t)rows * (cell_span_end(x_bounds, c) - x_bounds[c]);
+    const uint64_t *cell = sums + c * 4;
+    row_colors[c * 3] = composite_cell(cell[0], cell[3], area, bg[0]);
+    row_colors[c * 3 + 1] = composite_cell(cell[1], cell[3], area, bg[1]);
+    row_colors[c * 3 + 2] = composite_cell(cell[2], cell[3], area, bg[2]);
+  }
+}
+
+// premultiplied r, g, b and alpha of the RGBA pixels [x0, x1) of a row
+static void sum_span_4(const uint8_t *src, int x0, int x1, uint32_t *out) {
+  uint32_t sr = 0, sg = 0, sb = 0, sa = 0;
+  int x = x0;
+#ifdef __SSE2__
+  // four pixels at a time, each one spread over 16 bit lanes and multiplied
+  // by its own alpha broadcast to its lanes. The alpha lanes keep the alpha
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i alpha_lanes = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+  const __m128i round = _mm_set1_epi16(128);
+  __m128i acc = zero;
+  for (; x + 4 <= x1; x += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(src + (size_t)x * 4));
+    __m128i halves[2] = {_mm_unpacklo_epi8(v, zero),
+                         _mm_unpackhi_epi8(v, zero)};
+    for (int h = 0; h < 2; h++) {
+      __m128i px = halves[h];
+      __m128i a = _mm_shufflehi_epi16(
+          _mm_shufflelo_epi16(px, _MM_SHUFFLE(3, 3, 3, 3)),
+          _MM_SHUFFLE(3, 3, 3, 3));
+      __m128i t = _mm_add_epi16(_mm_mullo_epi16(px, a), round);
+      __m128i pm = _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+      pm = _mm_or_si128(_mm_andnot_si128(alpha_lanes, pm),
+                        _mm_and_si128(alpha_lanes, px));
+      // both pixels of the half land on the same four 32 bit lanes
+      acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(pm, zero));
+      acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(pm, zero));
+    }
+  }
+  uint32_t lanes[4];
+  _mm_storeu_si128((__m128i *)lanes, acc);
+  sr = lanes[0];
+  sg = lanes[1];
+  sb = lanes[2];
+  sa = lanes[3];
+#endif
+  for (; x < x1; x++) {
+    uint32_t r, g, b, a;
+    LOAD_PIXEL_4(src + (size_t)x * 4, r, g, b, a);
+    sr += r;
+    sg += g;
+    sb += b;
+    sa += a;
+  }
+  out[0] = sr;
+  out[1] = sg;
+  out[2] = sb;
+  out[3] = sa;
+}
+
+// premultiplied r, g, b and alpha of the pixels [x0, x1) of a row
+#define DEFINE_SUM_SPAN(CHANNELS)                                              \
+  static inline void sum_span_##CHANNELS(const uint8_t *src, int x0, int x1,   \
+                                         uint32_t *out) {                      \
+    uint32_t sr = 0, sg = 0, sb = 0, sa = 0;                                   \
+    for (int x = x0; x < x1; x++) {                                            \
+      uint32_t r, g, b, a;                                                     \
+      LOAD_PIXEL_##CHANNELS(src + (size_t)x * CHANNELS, r, g, b, a);           \
+      sr += r;                                                                 \
+      sg += g;                                                                 \
+      sb += b;                                                                 \
+      sa += a;                                                                 \
+    }                                                                          \
+    out[0] = sr;                                                               \
+    out[1] = sg;                                                               \
+    out[2] = sb;                                                               \
+    out[3] = sa;                                                               \
+  }
+
+DEFINE_SUM_SPAN(1)
+DEFINE_SUM_SPAN(2)
+DEFINE_SUM_SPAN(3)
+
+// average all the pixels inside a row of cells, the source rows are walked
+// once from top to bottom and left to right so the image is streamed in memory
+// order while the per cell accumulators (cols * 4 words) stay in L1. One copy
+// is generated per channel count so the inner loop has a constant stride.
+// Transparent pixels are composited on the background here, on the sums,
+// so there is no separate pass over the image
+#define DEFINE_SAMPLE_CELL_ROW(CHANNELS)                                       \
+  static void sample_cell_row_##CHANNELS(                                      \
+      const uint8_t *image, int width, int y0, int y1, const int *x_bounds,    \
+      int cols, uint64_t *sums, const uint8_t *bg, uint8_t *row_colors) {      \
+    memset(sums, 0, (size_t)cols * 4 * sizeof(uint64_t));                     \
+    for (int y = y0; y < y1; y++) {                                            \
+      const uint8_t *src = image + (size_t)y * width * CHANNELS;               \
+      for (int c = 0; c < cols; c++) {                                         \
+        uint32_t span[4];                                                      \
+        sum_span_##CHANNELS(src, x_bounds[c], cell_span_end(x_bounds, c),      \
+                            span);                                             \
+        sums[c * 4] += span[0];                                                \
+        sums[c * 4 + 1] += span[1];                                            \
+        sums[c * 4 + 2] += span[2];                                            \
+        sums[c * 4 + 3] += span[3];                                            \
+      }                                                                        \
+    }                                                                          \
+    average_cells(sums, y1 - y0, x_bounds, cols, bg, row_colors);              \
+  }
+
+DEFINE_SAMPLE_CELL_ROW(1)
+DEFINE_SAMPLE_CELL_ROW(2)
+DEFINE_SAMPLE_CELL_ROW(3)
+DEFINE_SAMPLE_CELL_ROW(4)
+
+// grayscale mode, one byte out per cell. Gray + alpha images are composited
+// on the gray level of the background
+static void sample_cell_row_gray(const uint8_t *image, int width, int y0,
+                                 int y1, const int *x_bounds, int cols,
+                                 uint64_t *sums, const uint8_t *bg,
+                                 uint8_t *row_luma) {
+  memset(sums, 0, (size_t)cols * sizeof(uint64_t));
+  for (int y = y0; y < y1; y++) {
+    const uint8_t *src = image + (size_t)y * width;
+    for (int c = 0; c < cols; c++) {
+      uint32_t sum = 0;
+      int x1 = cell_span_end(x_bounds, c);
+      for (int x = x_bounds[c]; x < x1; x++) {
+        sum += src[x];
+      }
+      sums[c] += sum;
+    }
+  }
+  for (int c = 0; c < cols; c++) {
+    uint64_t area =
+        (uint64_t)(y1 - y0) * (cell_span_end(x_bounds, c) - x_bounds[c]);
+    row_luma[c] = composite_cell(sums[c], 255 * area, area, bg[0]);
+  }
+}
+
+static void sample_cell_row_gray_alpha(const uint8_t *image, int width, int y0,
+                                       int y1, const int *x_bounds, int cols,
+                                       uint64_t *sums, const uint8_t *bg,
+                                       uint8_t *row_luma) {
+  memset(sums, 0, (size_t)cols * 2 * sizeof(uint64_t));
+  for (int y = y0; y < y1; y++) {
+    const uint8_t *src = image + (size_t)y * width * 2;
+    for (int c = 0; c < cols; c++) {
+      uint32_t span[4];
+      sum_span_2(src, x_bounds[c], cell_span_end(x_bounds, c), span);
+      sums[c * 2] += span[0];
+      sums[c * 2 + 1] += span[3];
+    }
+  }
+  for (int c = 0; c < cols; c++) {
+    uint64_t area =
+        (uint64_t)(y1 - y0) * (cell_span_end(x_bounds, c) - x_bounds[c]);
+    row_luma[c] = composite_cell(sums[c * 2], sums[c * 2 + 1], area, bg[0]);
+  }
+}
+
+SampleRowFn get_cell_row_sampler(int channels, int out_channels) {
+  if (out_channels == 1) {
+    switch (channels) {
+    case 1:
+      return sample_cell_row_gray;
+    case 2:
+      return sample_cell_row_gray_alpha;
+    default:
+      return NULL;
+    }
+  }
+  switch (channels) {
+  case 1:
+    return sample_cell_row_1;
+  case 2:
+    return sample_cell_row_2;
+  case 3:
+    return sample_cell_row_3;
+  case 4:
+    return sample_cell_row_4;
+  default:
+    return NULL;
+  }
+}
+
+// running sums of one image row added to the table row above it, `planes`
+// color sums per entry and one more for the alpha when the image has one
+#define DEFINE_SAT_ROW(NAME, CHANNELS, PLANES, ALPHA)                          \
+  static void sat_row_##NAME(const uint8_t *src, int width,                    \
+                             const uint32_t *above, uint32_t *row) {           \
+    const int entry = PLANES + ALPHA;                                          \
+    uint32_t sr = 0, sg = 0, sb = 0, sa = 0;                                   \
+    for (int k = 0; k < entry; k++) {                                          \
+      row[k] = 0;                                                              \
+    }                                                                          \
+    for (int x = 0; x < width; x++) {                                          \
+      uint32_t r, g, b, a;                                                     \
+      LOAD_PIXEL_##CHANNELS(src + (size_t)x * CHANNELS, r, g, b, a);           \
+      sr += r;                                                                 \
+      sg += g;                                                                 \
+      sb += b;                                                                 \
+      sa += a;                                                                 \
+      uint32_t *out = row + (x + 1) * entry;                                   \
+      const uint32_t *up = above + (x + 1) * entry;                            \
+      out[0] = up[0] + sr;                                                     \
+      if (PLANES == 3) {                                                       \
+        out[1] = up[1] + sg;                                                   \
+        out[2] = up[2] + sb;                                                   \
+      }                                                                        \
+      if (ALPHA) {                                                             \
+        out[PLANES] = up[PLANES] + sa;                                         \
+      }                                                                        \
+    }                                                                          \
+  }
+
+DEFINE_SAT_ROW(1, 1, 3, 0)
+DEFINE_SAT_ROW(2, 2, 3, 1)
+DEFINE_SAT_ROW(3, 3, 3, 0)
+DEFINE_SAT_ROW(4, 4, 3, 1)
+// grayscale mode, a single color sum per entry
+DEFINE_SAT_ROW(gray, 1, 1, 0)
+DEFINE_SAT_ROW(gray_alpha, 2, 1, 1)
+
+SummedAreaTable *sat_build(const uint8_t *rgb_image, int width, int height,
+                           int channels, int planes) {
+  void (*build_row)(const uint8_t *, int, const uint32_t *, uint32_t *) = NULL;
+  if (planes == 1) {
+    build_row = channels == 1   ? sat_row_gray
+                : channels == 2 ? sat_row_gray_alpha
+                                : NULL;
+  } else if (planes == 3) {
+    switch (channels) {
+    case 1:
+      build_row = sat_row_1;
+      break;
+    case 2:
+      build_row = sat_row_2;
+      break;
+    case 3:
+      build_row = sat_row_3;
+      break;
+    case 4:
+      build_row = sat_row_4;
+      break;
+    }
+  }
+  if (!build_row) {
+    return NULL;
+  }
+
+  bool alpha = channels == 2 || channels == 4;
+  size_t stride = ((size_t)width + 1) * (planes + alpha);
+  SummedAreaTable *sat = malloc(sizeof(SummedAreaTable));
+  if (!sat) {
+    return NULL;
+  }
+  sat->width = width;
+  sat->height = height;
+  sat->planes = planes;
+  sat->alpha = alpha;
+  sat->sums = malloc(sat_size(width, height, planes + alpha));
+  if (!sat->sums) {
+    printf("Error: Failed to allocate summed-area table\n");
+    free(sat);
+    return NULL;
+  }
+
+  // first row and column are zeros so lookups never need a bounds check
+  memset(sat->sums, 0, stride * sizeof(uint32_t));
+  for (int y = 0; y < height; y++) {
+    build_row(rgb_image + (size_t)y * width * channels, width,
+              sat->sums + (size_t)y * stride,
+              sat->sums + ((size_t)y + 1) * stride);
+  }
+  return sat;
+}
+
+size_t sat_size(int width, int height, int entry) {
+  return ((size_t)width + 1) * entry * ((size_t)height + 1) *
+         sizeof(uint32_t);
+}
+
+void sat_free(SummedAreaTable *sat) {
+  if (!sat) {
+    return;
+  }
+  free(sat->sums);
+  free(sat);
+}
+
+// one pixel of a reduced level from the sums of the pixels it covers. Colors
+// with alpha are summed premultiplied and divided back by the alpha so the
+// transparent pixels don't darken their neighbours
+static inline void store_reduced(uint8_t *out, int channels, uint32_t sr,
+                                 uint32_t sg, uint32_t sb, uint32_t sa,
+                                 uint32_t n) {
+  if (channels == 2 || channels == 4) {
+    uint32_t colors[3] = {sr, sg, sb};
+    for (int k = 0; k < channels - 1; k++) {
+      uint32_t c = sa ? (colors[k] * 255 + sa / 2) / sa : 0;
+      out[k] = c < 255 ? c : 255;
+    }
+    out[channels - 1] = (sa + n / 2) / n;
+    return;
+  }
+  out[0] = (sr + n / 2) / n;
+  if (channels == 3) {
+    out[1] = (sg + n / 2) / n;
+    out[2] = (sb + n / 2) / n;
+  }
+}
+
+// average every 2x2 block of src into dst, the last row and column of odd
+// sizes average the pixels they have
+#define DEFINE_REDUCE(CHANNELS)                                                \
+  static void reduce_##CHANNELS(const uint8_t *src, int width, int height,     \
+                                uint8_t *dst) {                                \
+    int out_w = (width + 1) / 2, out_h = (height + 1) / 2;                     \
+    for (int y = 0; y < out_h; y++) {                                          \
+      int y1 = 2 * y + 2 < height ? 2 * y + 2 : height;                        \
+      for (int x = 0; x < out_w; x++) {                                        \
+        int x1 = 2 * x + 2 < width ? 2 * x + 2 : width;                        \
+        uint32_t sr = 0, sg = 0, sb = 0, sa = 0, n = 0;                        \
+        for (int sy = 2 * y; sy < y1; sy++) {                                  \
+          for (int sx = 2 * x; sx < x1; sx++) {                                \
+            uint32_t r, g, b, a;                                               \
+            LOAD_PIXEL_##CHANNELS(                                             \
+                src + ((size_t)sy * width + sx) * CHANNELS, r, g, b, a);       \
+            sr += r;                                                           \
+            sg += g;                                                           \
+            sb += b;                                                           \
+            sa += a;                                                           \
+            n++;                                                               \
+          }                                                                    \
+        }                                                                      \
+        store_reduced(dst + ((size_t)y * out_w + x) * CHANNELS, CHANNELS, sr,  \
+                      sg, sb, sa, n);                                          \
+      }                                                                        \
+    }                                                                          \
+  }
+
+DEFINE_REDUCE(1)
+DEFINE_REDUCE(2)
+DEFINE_REDUCE(3)
+DEFINE_REDUCE(4)
+
+ImagePyramid *pyramid_build(const uint8_t *image, int width, int height,
+                            int channels) {
+  void (*reduce)(const uint8_t *, int, int, uint8_t *) = NULL;
+  switch (channels) {
+  case 1:
+    reduce = reduce_1;
+    break;
+  case 2:
+    reduce = reduce_2;
+    break;
+  case 3:
+    reduce = reduce_3;
+    break;
+  case 4:
+    reduce = reduce_4;
+    break;
+  default:
+    return NULL;
+  }
+
+  int count = 0;
+  for (int w = width, h = height; w > 1 || h > 1; count++) {
+    w = (w + 1) / 2;
+    h = (h + 1) / 2;
+  }
+  ImagePyramid *pyramid = calloc(1, sizeof(ImagePyramid));
+  if (!pyramid) {
+    return NULL;
+  }
+  pyramid->channels = channels;
+  pyramid->levels = calloc(count ? count : 1, sizeof(PyramidLevel));
+  if (!pyramid->levels) {
+    free(pyramid);
+    return NULL;
+  }
+
+  const uint8_t *src = image;
+  for (int i = 0; i < count; i++) {
+    PyramidLevel *level = &pyramid->levels[i];
+    level->width = (width + 1) / 2;
+    level->height = (height + 1) / 2;
+    level->pixels =
+        malloc((size_t)level->width * level->height * channels);
+    if (!level->pixels) {
+      printf("Error: Failed to allocate image pyramid\n");
+      pyramid_free(pyramid);
+      return NULL;
+    }
+    pyramid->count = i + 1;
+    reduce(src, width, height, level->pixels);
+    src = level->pixels;
+    width = level->width;
+    height = level->height;
+  }
+  return pyramid;
+}
+
+size_t pyramid_size(const ImagePyramid *pyramid) {
+  size_t size = 0;
+  for (int i = 0; i < pyramid->count; i++) {
+    size += (size_t)pyramid->levels[i].width * pyramid->levels[i].height *
+            pyramid->channels;
+  }
+  return size;
+}
+
+const PyramidLevel *pyramid_pick_level(const ImagePyramid *pyramid, int cols,
+                                       int rows) {
+  const PyramidLevel *pick = NULL;
+  for (int i = 0; pyramid && i < pyramid->count; i++) {
+    if (pyramid->levels[i].width < cols || pyramid->levels[i].height < rows) {
+      break;
+    }
+    pick = &pyramid->levels[i];
+  }
+  return pick;
+}
+
+void pyramid_free(ImagePyramid *pyramid) {
+  if (!pyramid) {
+    return;
+  }
+  for (int i = 0; i < pyramid->count; i++) {
+    free(pyramid->levels[i].pixels);
+  }
+  free(pyramid->levels);
+  free(pyramid);
+}
+
+// the luminance of a cell comes from its averaged color, so there is no need
+// for a separate luminance table
+void sat_sample_cell_row(const SummedAreaTable *sat, int y0, int y1,
+                         const int *x_bounds, int cols, const uint8_t *bg,
+                         uint8_t *row_colors) {
+  int planes = sat->planes;
+  int entry = planes + sat->alpha;
+  size_t stride = ((size_t)sat->width + 1) * entry;
+  const uint32_t *top = sat->sums + (size_t)y0 * stride;
+  const uint32_t *bottom = sat->sums + (size_t)y1 * stride;
+
+  for (int c = 0; c < cols; c++) {
+    int x0 = x_bounds[c];
+    int x1 = cell_span_end(x_bounds, c);
+    uint32_t area = (uint32_t)(y1 - y0) * (x1 - x0);
+    // opaque images have no alpha sums, every pixel counts as 255
+    uint32_t sum_a = 255 * area;
+    if (sat->alpha) {
+      sum_a = bottom[x1 * entry + planes] - bottom[x0 * entry + planes] -
+              top[x1 * entry + planes] + top[x0 * entry + planes];
+    }
+    for (int k = 0; k < planes; k++) {
+      uint32_t sum = bottom[x1 * entry + k] - bottom[x0 * entry + k] -
+                     top[x1 * entry + k] + top[x0 * entry + k];
+      row_colors[c * planes + k] = composite_cell(sum, sum_a, area, bg[k]);
+    }
+  }
+}
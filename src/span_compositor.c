@@ -0,0 +1,130 @@
+#include <pthread.h>
+#include <span_compositor.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SPAN_COMPOSITOR_X86
+#endif
+
+typedef int (*SpanKernel)(uint8_t *dst, const uint8_t *coverage,
+                          const uint8_t *pattern, int bytes);
+
+static SpanKernel simd_kernel = NULL;
+static const char *kernel_name = "scalar";
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+// t / 255 rounded as (t + (t >> 8)) >> 8 once t has 128 added, exact for
+// every t below 255 * 256. The products below stay in 16 bits: with
+// dst * (255 - c) + color * c <= 255 * 255 the sum is at most 65153
+static inline uint8_t blend(uint8_t dst, uint8_t color, uint8_t c) {
+  uint32_t t = dst * (255 - c) + color * c + 128;
+  return (t + (t >> 8)) >> 8;
+}
+
+static void span_scalar(uint8_t *dst, const uint8_t *coverage,
+                        const uint8_t *pattern, int from, int bytes) {
+  for (int i = from; i < bytes; i++) {
+    dst[i] = blend(dst[i], pattern[i % COMPOSITE_PATTERN_PERIOD],
+                   coverage[i]);
+  }
+}
+
+#ifdef SPAN_COMPOSITOR_X86
+// blend of 8 bytes held in 16 bit lanes
+__attribute__((target("sse2"))) static inline __m128i
+blend_epi16_sse2(__m128i d, __m128i p, __m128i c) {
+  const __m128i full = _mm_set1_epi16(255);
+  const __m128i round = _mm_set1_epi16(128);
+  __m128i t = _mm_add_epi16(_mm_mullo_epi16(d, _mm_sub_epi16(full, c)),
+                            _mm_add_epi16(_mm_mullo_epi16(p, c), round));
+  return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("sse2"))) static int
+span_sse2(uint8_t *dst, const uint8_t *coverage, const uint8_t *pattern,
+          int bytes) {
+  const __m128i zero = _mm_setzero_si128();
+  int i = 0;
+  for (; i + 16 <= bytes; i += 16) {
+    __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+    __m128i c = _mm_loadu_si128((const __m128i *)(coverage + i));
+    __m128i p = _mm_loadu_si128(
+        (const __m128i *)(pattern + i % COMPOSITE_PATTERN_PERIOD));
+    __m128i lo = blend_epi16_sse2(_mm_unpacklo_epi8(d, zero),
+                                  _mm_unpacklo_epi8(p, zero),
+                                  _mm_unpacklo_epi8(c, zero));
+    __m128i hi = blend_epi16_sse2(_mm_unpackhi_epi8(d, zero),
+                                  _mm_unpackhi_epi8(p, zero),
+                                  _mm_unpackhi_epi8(c, zero));
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) static inline __m256i
+blend_epi16_avx2(__m256i d, __m256i p, __m256i c) {
+  const __m256i full = _mm256_set1_epi16(255);
+  const __m256i round = _mm256_set1_epi16(128);
+  __m256i t =
+      _mm256_add_epi16(_mm256_mullo_epi16(d, _mm256_sub_epi16(full, c)),
+                       _mm256_add_epi16(_mm256_mullo_epi16(p, c), round));
+  return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+// unpacks and packs work inside each 128 bit lane, so the bytes come back
+// in the order they were loaded
+__attribute__((target("avx2"))) static int
+span_avx2(uint8_t *dst, const uint8_t *coverage, const uint8_t *pattern,
+          int bytes) {
+  const __m256i zero = _mm256_setzero_si256();
+  int i = 0;
+  for (; i + 32 <= bytes; i += 32) {
+    __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+    __m256i c = _mm256_loadu_si256((const __m256i *)(coverage + i));
+    __m256i p = _mm256_loadu_si256(
+        (const __m256i *)(pattern + i % COMPOSITE_PATTERN_PERIOD));
+    __m256i lo = blend_epi16_avx2(_mm256_unpacklo_epi8(d, zero),
+                                  _mm256_unpacklo_epi8(p, zero),
+                                  _mm256_unpacklo_epi8(c, zero));
+    __m256i hi = blend_epi16_avx2(_mm256_unpackhi_epi8(d, zero),
+                                  _mm256_unpackhi_epi8(p, zero),
+                                  _mm256_unpackhi_epi8(c, zero));
+    _mm256_storeu_si256((__m256i *)(dst + i), _mm256_packus_epi16(lo, hi));
+  }
+  // glyph rows are often shorter than 32 bytes, finish with SSE2
+  return i + span_sse2(dst + i, coverage + i,
+                       pattern + i % COMPOSITE_PATTERN_PERIOD, bytes - i);
+}
+#endif
+
+static void select_kernel(void) {
+#ifdef SPAN_COMPOSITOR_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    simd_kernel = span_avx2;
+    kernel_name = "avx2";
+  } else if (__builtin_cpu_supports("sse2")) {
+    simd_kernel = span_sse2;
+    kernel_name = "sse2";
+  }
+#endif
+}
+
+void composite_pattern_init(uint8_t *pattern, const uint8_t *color,
+                            int channels) {
+  for (int i = 0; i < COMPOSITE_PATTERN_SIZE; i++) {
+    pattern[i] = color[i % channels];
+  }
+}
+
+void composite_span(uint8_t *dst, const uint8_t *coverage,
+                    const uint8_t *pattern, int bytes) {
+  pthread_once(&kernel_once, select_kernel);
+  int done = simd_kernel ? simd_kernel(dst, coverage, pattern, bytes) : 0;
+  span_scalar(dst, coverage, pattern, done, bytes);
+}
+
+const char *composite_kernel_name(void) {
+  pthread_once(&kernel_once, select_kernel);
+  return kernel_name;
+}
@@ -0,0 +1,109 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stream_reader.h>
+#include <string.h>
+#include <unistd.h>
+
+// first read-ahead size, doubled every time the decoder runs past it
+static const size_t initial_capacity = 64 << 10;
+
+// read until `wanted` bytes are buffered or the stream ends
+static int fill_to(StreamReader *reader, size_t wanted) {
+  while (reader->size < wanted && !reader->eof) {
+    if (reader->size == reader->capacity) {
+      size_t capacity =
+          reader->capacity ? reader->capacity * 2 : initial_capacity;
+      uint8_t *data = realloc(reader->data, capacity);
+      if (!data) {
+        printf("Error: Failed to grow the input buffer\n");
+        return -1;
+      }
+      reader->data = data;
+      reader->capacity = capacity;
+    }
+    ssize_t n = read(reader->fd, reader->data + reader->size,
+                     reader->capacity - reader->size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      perror("Error reading input");
+      return -1;
+    }
+    reader->eof = n == 0;
+    reader->size += n;
+  }
+  return 0;
+}
+
+static int stream_read(void *user, char *data, int size) {
+  StreamReader *reader = (StreamReader *)user;
+  if (fill_to(reader, reader->pos + size)) {
+    reader->eof = true;
+  }
+  size_t left = reader->size - reader->pos;
+  size_t n = (size_t)size < left ? (size_t)size : left;
+  memcpy(data, reader->data + reader->pos, n);
+  reader->pos += n;
+  return (int)n;
+}
+
+// everything read so far is kept, so stb can skip back over bytes it
+// peeked at and the header can be parsed again by the decode
+static void stream_skip(void *user, int n) {
+  StreamReader *reader = (StreamReader *)user;
+  if (n < 0) {
+    reader->pos = (size_t)-n > reader->pos ? 0 : reader->pos + n;
+    return;
+  }
+  if (fill_to(reader, reader->pos + n)) {
+    reader->eof = true;
+  }
+  reader->pos = reader->pos + n < reader->size ? reader->pos + n
+                                                : reader->size;
+}
+
+static int stream_eof(void *user) {
+  StreamReader *reader = (StreamReader *)user;
+  if (reader->pos < reader->size) {
+    return 0;
+  }
+  if (fill_to(reader, reader->pos + 1)) {
+    reader->eof = true;
+  }
+  return reader->pos >= reader->size;
+}
+
+const stbi_io_callbacks stream_reader_callbacks = {stream_read, stream_skip,
+                                                   stream_eof};
+
+StreamReader *stream_reader_new(int fd) {
+  StreamReader *reader = calloc(1, sizeof(StreamReader));
+  if (!reader) {
+    close(fd);
+    return NULL;
+  }
+  reader->fd = fd;
+  return reader;
+}
+
+int stream_reader_drain(StreamReader *reader) {
+  while (!reader->eof) {
+    if (fill_to(reader, reader->capacity + 1)) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void stream_reader_rewind(StreamReader *reader) { reader->pos = 0; }
+
+void stream_reader_free(StreamReader *reader) {
+  if (!reader) {
+    return;
+  }
+  close(reader->fd);
+  free(reader->data);
+  free(reader);
+}
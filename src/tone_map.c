@@ -0,0 +1,150 @@
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
+#include <tone_map.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// the HDR table is indexed by the top bits of the float itself, exponent and
+// the first 10 bits of the mantissa, from 2^HDR_MIN_EXP up to 2^HDR_MAX_EXP.
+// Values below are black, values above are white
+#define HDR_MIN_EXP -16
+#define HDR_MAX_EXP 8
+#define HDR_MANTISSA_BITS 10
+#define HDR_SHIFT (23 - HDR_MANTISSA_BITS)
+#define HDR_LUT_SIZE ((HDR_MAX_EXP - HDR_MIN_EXP) << HDR_MANTISSA_BITS)
+// middle gray the log-average luminance is mapped to
+#define HDR_KEY 0.18f
+#define HDR_GAMMA (1 / 2.2)
+
+static uint8_t hdr_lut[HDR_LUT_SIZE];
+static pthread_once_t hdr_lut_once = PTHREAD_ONCE_INIT;
+
+static uint32_t float_bits(float v) {
+  uint32_t bits;
+  memcpy(&bits, &v, sizeof(bits));
+  return bits;
+}
+
+// Reinhard x / (1 + x) then gamma, evaluated at the middle of each bucket
+static void build_hdr_lut(void) {
+  uint32_t base = float_bits(ldexpf(1, HDR_MIN_EXP)) >> HDR_SHIFT;
+  for (int i = 0; i < HDR_LUT_SIZE; i++) {
+    uint32_t bits = ((base + i) << HDR_SHIFT) | (1u << (HDR_SHIFT - 1));
+    float x;
+    memcpy(&x, &bits, sizeof(x));
+    hdr_lut[i] = (uint8_t)(pow(x / (1 + x), HDR_GAMMA) * 255 + 0.5);
+  }
+  // everything clamped up to the first bucket is black
+  hdr_lut[0] = 0;
+}
+
+static inline uint8_t hdr_lookup(float v) {
+  static const float lo = 0x1p-16f, hi = 0x1.fffffep7f;
+  v = v > lo ? v : lo; // also maps NaN to black
+  v = v < hi ? v : hi;
+  uint32_t base = float_bits(lo) >> HDR_SHIFT;
+  return hdr_lut[(float_bits(v) >> HDR_SHIFT) - base];
+}
+
+static inline uint8_t clamp_alpha(float a) {
+  a = a > 0 ? (a < 1 ? a : 1) : 0;
+  return (uint8_t)(a * 255 + 0.5f);
+}
+
+void samples16_to_8(const uint16_t *src, size_t count, uint8_t *dst) {
+  size_t i = 0;
+#ifdef __SSE2__
+  // round(v * 255 / 65535) as (v * 255 + 32895) >> 16, the high half of the
+  // product plus the carry out of its low half
+  const __m128i k255 = _mm_set1_epi16(255);
+  const __m128i flip = _mm_set1_epi16((short)0x8000);
+  const __m128i carry_at = _mm_set1_epi16((short)(32640 ^ 0x8000));
+  for (; i + 16 <= count; i += 16) {
+    __m128i v0 = _mm_loadu_si128((const __m128i *)(src + i));
+    __m128i v1 = _mm_loadu_si128((const __m128i *)(src + i + 8));
+    __m128i hi0 = _mm_mulhi_epu16(v0, k255);
+    __m128i hi1 = _mm_mulhi_epu16(v1, k255);
+    __m128i lo0 = _mm_xor_si128(_mm_mullo_epi16(v0, k255), flip);
+    __m128i lo1 = _mm_xor_si128(_mm_mullo_epi16(v1, k255), flip);
+    hi0 = _mm_sub_epi16(hi0, _mm_cmpgt_epi16(lo0, carry_at));
+    hi1 = _mm_sub_epi16(hi1, _mm_cmpgt_epi16(lo1, carry_at));
+    // both loads are done before the store, so dst may alias src
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(hi0, hi1));
+  }
+#endif
+  for (; i < count; i++) {
+    dst[i] = ((uint32_t)src[i] * 255 + 32895) >> 16;
+  }
+}
+
+// log2 from the exponent and a quadratic fit of the mantissa, within 0.005
+// of the exact one, plenty for an average over the whole image
+static inline float fast_log2(float x) {
+  uint32_t bits = float_bits(x);
+  int exponent = (int)((bits >> 23) & 0xff) - 127;
+  bits = (bits & 0x007fffff) | 0x3f800000;
+  float m;
+  memcpy(&m, &bits, sizeof(m));
+  return exponent + (-0.34484843f * m + 2.02466578f) * m - 1.67487759f;
+}
+
+// log-average luminance of the image, the exposure that maps it to HDR_KEY.
+// NaN and infinite samples are left out, one of them would otherwise set
+// the exposure of every other pixel
+static float hdr_exposure(const float *src, size_t count, int channels) {
+  double log_sum = 0;
+  size_t finite = 0;
+  for (size_t i = 0; i < count; i++) {
+    const float *p = src + i * channels;
+    float lum = channels >= 3
+                    ? 0.2126f * p[0] + 0.7152f * p[1] + 0.0722f * p[2]
+                    : p[0];
+    if (!isfinite(lum)) {
+      continue;
+    }
+    log_sum += fast_log2(1e-4f + (lum > 0 ? lum : 0));
+    finite++;
+  }
+  double log_avg = finite ? exp2(log_sum / finite) : 1;
+  return (float)(HDR_KEY / log_avg);
+}
+
+void hdr_to_8(const float *src, size_t count, int channels, uint8_t *dst) {
+  pthread_once(&hdr_lut_once, build_hdr_lut);
+  float exposure = hdr_exposure(src, count, channels);
+  int alpha = channels == 2 || channels == 4;
+  size_t samples = count * channels;
+  size_t i = 0;
+
+#ifdef __SSE2__
+  // the table index is computed four samples at a time, only the lookups
+  // themselves are scalar. Images with alpha take the scalar loop
+  if (!alpha) {
+    const __m128 scale = _mm_set1_ps(exposure);
+    const __m128 lo = _mm_set1_ps(0x1p-16f), hi = _mm_set1_ps(0x1.fffffep7f);
+    const __m128i base =
+        _mm_set1_epi32((int)(float_bits(0x1p-16f) >> HDR_SHIFT));
+    for (; i + 4 <= samples; i += 4) {
+      __m128 v = _mm_mul_ps(_mm_loadu_ps(src + i), scale);
+      // maxps returns its second operand when either one is NaN, so NaN
+      // falls to lo and comes out black like in hdr_lookup
+      v = _mm_min_ps(_mm_max_ps(v, lo), hi);
+      __m128i idx = _mm_sub_epi32(
+          _mm_srli_epi32(_mm_castps_si128(v), HDR_SHIFT), base);
+      uint32_t lanes[4];
+      _mm_storeu_si128((__m128i *)lanes, idx);
+      dst[i] = hdr_lut[lanes[0]];
+      dst[i + 1] = hdr_lut[lanes[1]];
+      dst[i + 2] = hdr_lut[lanes[2]];
+      dst[i + 3] = hdr_lut[lanes[3]];
+    }
+  }
+#endif
+  for (; i < samples; i++) {
+    int is_alpha = alpha && i % channels == (size_t)channels - 1;
+    dst[i] = is_alpha ? clamp_alpha(src[i]) : hdr_lookup(src[i] * exposure);
+  }
+}
@@ -1,4 +1,7 @@
+#include <pthread.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <utils.h>
 
 const char *get_filename_ext(const char *filename) {
@@ -7,3 +10,36 @@ const char *get_filename_ext(const char *filename) {
     return "";
   return dot + 1;
 }
+
+int checked_size_mul3(size_t a, size_t b, size_t c, size_t *out) {
+  size_t ab;
+  if (__builtin_mul_overflow(a, b, &ab) || __builtin_mul_overflow(ab, c, out)) {
+    return 1;
+  }
+  return 0;
+}
+
+int get_worker_count(int max_jobs) {
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  int workers = cores > 0 ? (int)cores : 1;
+  if (workers > max_jobs) {
+    workers = max_jobs;
+  }
+  return workers > 0 ? workers : 1;
+}
+
+void run_on_workers(int workers, void *(*routine)(void *), void *arg) {
+  pthread_t *threads = malloc(sizeof(pthread_t) * workers);
+  int started = 0;
+  // if a thread can't be created the remaining ones just pull more work
+  for (int i = 1; threads && i < workers; i++) {
+    if (pthread_create(&threads[started], NULL, routine, arg) == 0) {
+      started++;
+    }
+  }
+  routine(arg);
+  for (int i = 0; i < started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  free(threads);
+}
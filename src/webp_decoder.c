@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <utils.h>
+#include <webp_decoder.h>
+
+#ifdef HAVE_LIBWEBP
+#include <webp/decode.h>
+
+int webp_info(const MappedFile *file, int *width, int *height, int *channels) {
+  WebPBitstreamFeatures features;
+  if (WebPGetFeatures(file->data, file->size, &features) != VP8_STATUS_OK) {
+    return 0;
+  }
+  *width = features.width;
+  *height = features.height;
+  *channels = features.has_alpha ? 4 : 3;
+  return 1;
+}
+
+// libwebp has no gray output, convert in place and keep the alpha if there is
+// one so it can still be composited on the background
+static void to_gray(uint8_t *pixels, size_t count, int channels) {
+  int out_channels = channels == 4 ? 2 : 1;
+  for (size_t i = 0; i < count; i++) {
+    const uint8_t *p = pixels + i * channels;
+    uint8_t *out = pixels + i * out_channels;
+    uint8_t alpha = channels == 4 ? p[3] : 255;
+    out[0] = rgb_to_gray(p[0], p[1], p[2]);
+    if (out_channels == 2) {
+      out[1] = alpha;
+    }
+  }
+}
+
+uint8_t *webp_decode_scaled(const MappedFile *file, int min_width,
+                            int min_height, bool grayscale, int *width,
+                            int *height, int *channels) {
+  WebPDecoderConfig config;
+  if (!WebPInitDecoderConfig(&config) ||
+      WebPGetFeatures(file->data, file->size, &config.input) !=
+          VP8_STATUS_OK) {
+    return NULL;
+  }
+  int src_w = config.input.width, src_h = config.input.height;
+
+  // same steps as the JPEG backend so both give the same grids, the
+  // libwebp rescaler averages the pixels it drops
+  int out_w = src_w, out_h = src_h;
+  for (int denom = 8; denom > 1; denom /= 2) {
+    int w = (src_w + denom - 1) / denom;
+    int h = (src_h + denom - 1) / denom;
+    if (w >= min_width && h >= min_height) {
+      out_w = w;
+      out_h = h;
+      break;
+    }
+  }
+  if (out_w != src_w || out_h != src_h) {
+    config.options.use_scaling = 1;
+    config.options.scaled_width = out_w;
+    config.options.scaled_height = out_h;
+  }
+
+  // decode straight into our own buffer so it is freed like the others
+  int out_channels = config.input.has_alpha ? 4 : 3;
+  size_t stride = (size_t)out_w * out_channels;
+  uint8_t *pixels = malloc(stride * out_h);
+  if (!pixels) {
+    printf("Error: Failed to allocate image buffer\n");
+    return NULL;
+  }
+  config.output.colorspace = out_channels == 4 ? MODE_RGBA : MODE_RGB;
+  config.output.is_external_memory = 1;
+  config.output.u.RGBA.rgba = pixels;
+  config.output.u.RGBA.stride = (int)stride;
+  config.output.u.RGBA.size = stride * out_h;
+
+  VP8StatusCode status = WebPDecode(file->data, file->size, &config);
+  WebPFreeDecBuffer(&config.output);
+  if (status != VP8_STATUS_OK) {
+    printf("Error: libwebp failed to decode the image (status %d)\n", status);
+    free(pixels);
+    return NULL;
+  }
+  if (grayscale) {
+    to_gray(pixels, (size_t)out_w * out_h, out_channels);
+    out_channels = out_channels == 4 ? 2 : 1;
+  }
+  *width = out_w;
+  *height = out_h;
+  *channels = out_channels;
+  return pixels;
+}
+
+#else
+
+int webp_info(const MappedFile *file, int *width, int *height, int *channels) {
+  (void)file;
+  (void)width;
+  (void)height;
+  (void)channels;
+  return 0;
+}
+
+uint8_t *webp_decode_scaled(const MappedFile *file, int min_width,
+                            int min_height, bool grayscale, int *width,
+                            int *height, int *channels) {
+  (void)file;
+  (void)min_width;
+  (void)min_height;
+  (void)grayscale;
+  (void)width;
+  (void)height;
+  (void)channels;
+  return NULL;
+}
+
+#endif // HAVE_LIBWEBP
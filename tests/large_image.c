@@ -0,0 +1,136 @@
+#include "cell_grid.h"
+#include "glyph_kernel.h"
+#include "logic.h"
+#include "sampler.h"
+#include "utils.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// exit code meson reads as a skipped test
+#define SKIP_TEST 77
+
+// a 1 channel image past 2^31 bytes, cells are CELL x CELL pixels and the
+// last row of cells starts at byte 2^31, where a 32-bit offset wraps around
+#define CELL 1024
+#define COLS 64
+#define ROWS 33
+#define WIDTH (COLS * CELL)
+#define HEIGHT (ROWS * CELL)
+
+static int failures = 0;
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);          \
+      failures++;                                                              \
+    }                                                                          \
+  } while (0)
+
+// gray of the cells of the last row, the others are black
+static uint8_t last_row_gray(int col) { return col % 2 ? 0 : 255; }
+
+static uint8_t gray_index(uint8_t gray) {
+  uint8_t index;
+  pixels_to_glyphs(&gray, 1, 1, &index, NULL);
+  return index;
+}
+
+static void check_sizes(void) {
+  size_t size;
+  CHECK(!checked_size_mul3(WIDTH, HEIGHT, 1, &size));
+  CHECK(size == (size_t)WIDTH * HEIGHT && size > INT32_MAX);
+  CHECK(!checked_size_mul3(WIDTH, HEIGHT, 3, &size));
+  CHECK(size == (size_t)WIDTH * HEIGHT * 3);
+  CHECK(checked_size_mul3(SIZE_MAX / 2, 3, 1, &size));
+  CHECK(checked_size_mul3(INT32_MAX, INT32_MAX, INT32_MAX, &size));
+}
+
+static void check_bounds(int *x_bounds, int *y_bounds) {
+  compute_cell_bounds(WIDTH, COLS, x_bounds);
+  compute_cell_bounds(HEIGHT, ROWS, y_bounds);
+  for (int i = 0; i < COLS; i++) {
+    CHECK(x_bounds[i] == i * CELL);
+    CHECK(cell_span_end(x_bounds, i) == (i + 1) * CELL);
+  }
+  for (int i = 0; i < ROWS; i++) {
+    CHECK(y_bounds[i] == i * CELL);
+    CHECK(cell_span_end(y_bounds, i) == (i + 1) * CELL);
+  }
+  CHECK(max_cell_span(x_bounds, COLS) == CELL);
+  CHECK((size_t)y_bounds[ROWS - 1] * WIDTH == (size_t)1 << 31);
+}
+
+static void check_sampler(const uint8_t *image, const int *x_bounds,
+                          const int *y_bounds) {
+  SampleRowFn sample_row = get_cell_row_sampler(1, 1);
+  uint64_t sums[COLS * 4];
+  uint8_t row_gray[COLS];
+  uint8_t bg = 255;
+  CHECK(sample_row != NULL);
+  if (!sample_row) {
+    return;
+  }
+  sample_row(image, WIDTH, y_bounds[0], cell_span_end(y_bounds, 0), x_bounds,
+             COLS, sums, &bg, row_gray);
+  for (int col = 0; col < COLS; col++) {
+    CHECK(row_gray[col] == 0);
+  }
+  sample_row(image, WIDTH, y_bounds[ROWS - 1],
+             cell_span_end(y_bounds, ROWS - 1), x_bounds, COLS, sums, &bg,
+             row_gray);
+  for (int col = 0; col < COLS; col++) {
+    CHECK(row_gray[col] == last_row_gray(col));
+  }
+}
+
+static void check_convert(const uint8_t *image) {
+  CellGrid *grid = cell_grid_new(COLS, ROWS, ROWS, 1, false);
+  CHECK(grid != NULL);
+  if (!grid) {
+    return;
+  }
+  RGB bg = {255, 255, 255};
+  CHECK(!convert_to_grid(image, NULL, NULL, WIDTH, HEIGHT, 1, &bg, grid));
+  for (int row = 0; row < ROWS; row++) {
+    const uint8_t *indices = cell_grid_indices(grid, row);
+    for (int col = 0; col < COLS; col++) {
+      uint8_t gray = row == ROWS - 1 ? last_row_gray(col) : 0;
+      CHECK(indices[col] == gray_index(gray));
+    }
+  }
+  cell_grid_free(grid);
+}
+
+int main(void) {
+  check_sizes();
+
+  // untouched pages of a calloc stay shared zeros, only the last row of
+  // cells takes memory
+  size_t size = (size_t)WIDTH * HEIGHT;
+  uint8_t *image = calloc(size, 1);
+  if (!image) {
+    printf("Skipped: can't allocate the %zu byte image\n", size);
+    return SKIP_TEST;
+  }
+  for (size_t y = (size_t)(ROWS - 1) * CELL; y < HEIGHT; y++) {
+    for (int col = 0; col < COLS; col++) {
+      memset(image + y * WIDTH + (size_t)col * CELL, last_row_gray(col), CELL);
+    }
+  }
+
+  int x_bounds[COLS + 1], y_bounds[ROWS + 1];
+  check_bounds(x_bounds, y_bounds);
+  check_sampler(image, x_bounds, y_bounds);
+  check_convert(image);
+  free(image);
+
+  if (failures) {
+    printf("%d checks failed\n", failures);
+    return 1;
+  }
+  printf("All checks passed\n");
+  return 0;
+}
@@ -0,0 +1,71 @@
+#include "tone_map.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+
+static int failures = 0;
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);          \
+      failures++;                                                              \
+    }                                                                          \
+  } while (0)
+
+static void check_samples16(void) {
+  static uint16_t src[65536 + 7];
+  static uint8_t dst[65536 + 7];
+  for (int i = 0; i < 65536 + 7; i++) {
+    src[i] = i & 0xffff;
+  }
+  samples16_to_8(src, 65536 + 7, dst);
+  for (int i = 0; i < 65536 + 7; i++) {
+    CHECK(dst[i] == ((i & 0xffff) * 255 + 32767) / 65535);
+  }
+}
+
+// with one channel the first four samples take the SIMD path and the fifth
+// the scalar one, both must map a value to the same level
+static uint8_t check_hdr_paths(float v) {
+  float src[5] = {v, v, v, v, v};
+  uint8_t dst[5];
+  hdr_to_8(src, 5, 1, dst);
+  for (int i = 0; i < 4; i++) {
+    CHECK(dst[i] == dst[4]);
+  }
+  return dst[4];
+}
+
+static void check_hdr(void) {
+  static const float values[] = {0, 1e-30f, 1e-5f, 0.01f, 0.18f, 1,
+                                 2, 100,    1e30f, -1,    -0.0f, INFINITY};
+  for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+    check_hdr_paths(values[i]);
+  }
+  CHECK(check_hdr_paths(NAN) == 0);
+  CHECK(check_hdr_paths(-INFINITY) == 0);
+
+  // non-finite samples don't move the exposure of the others
+  uint8_t plain = check_hdr_paths(0.18f);
+  float with_nan[5] = {0.18f, NAN, 0.18f, 0.18f, NAN};
+  uint8_t dst[5];
+  hdr_to_8(with_nan, 5, 1, dst);
+  CHECK(dst[1] == 0 && dst[4] == 0);
+  CHECK(dst[0] == plain && dst[2] == plain && dst[3] == plain);
+  float with_inf[5] = {0.18f, INFINITY, 0.18f, 0.18f, 0.18f};
+  hdr_to_8(with_inf, 5, 1, dst);
+  CHECK(dst[1] == 255);
+  CHECK(dst[0] == plain && dst[2] == plain && dst[4] == plain);
+}
+
+int main(void) {
+  check_samples16();
+  check_hdr();
+  if (failures) {
+    printf("%d checks failed\n", failures);
+    return 1;
+  }
+  printf("All checks passed\n");
+  return 0;
+}